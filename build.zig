@@ -1,38 +1,118 @@
 const std = @import("std");
 
 pub fn build(b: *std.Build) void {
+    const profile = b.option(bool, "profile", "Compile in the guest execution profiler") orelse false;
+    const fuzz = b.option(bool, "fuzz", "Build the chippy-fuzz target for the cpu core") orelse false;
+
     const exe = b.addExecutable(.{
         .name = "chippy",
         .target = b.host,
     });
 
-    exe.addCSourceFile(.{ .file = b.path("chippy.c"), .flags = &.{
-        "-std=c99",
-        "-Wall",
-        "-W",
-        "-Wstrict-prototypes",
-        "-Wwrite-strings",
-        "-Wno-missing-field-initializers",
-    } });
-    exe.addCSourceFile(.{ .file = b.path("cpu.c"), .flags = &.{
-        "-std=c99",
-        "-Wall",
-        "-W",
-        "-Wstrict-prototypes",
-        "-Wwrite-strings",
-        "-Wno-missing-field-initializers",
-    } });
-    exe.addCSourceFile(.{ .file = b.path("media.c"), .flags = &.{
+    var flags = std.ArrayList([]const u8).init(b.allocator);
+    flags.appendSlice(&.{
         "-std=c99",
         "-Wall",
         "-W",
         "-Wstrict-prototypes",
         "-Wwrite-strings",
         "-Wno-missing-field-initializers",
-    } });
+    }) catch @panic("OOM");
+    if (profile)
+        flags.append("-DCHIPPY_PROFILE") catch @panic("OOM");
+
+    const sources = [_][]const u8{
+        "chippy.c",
+        "cpu.c",
+        "display.c",
+        "media.c",
+        "media_sdl.c",
+        "media_headless.c",
+        "profile.c",
+        "stats.c",
+        "trace.c",
+        "lz.c",
+        "debug.c",
+        "quirks.c",
+        "sched.c",
+        "stream.c",
+        "shm.c",
+        "term.c",
+        "export.c",
+        "inputlog.c",
+        "work.c",
+        "worker.c",
+    };
+    for (sources) |source| {
+        exe.addCSourceFile(.{ .file = b.path(source), .flags = flags.items });
+    }
     exe.linkSystemLibrary("m");
-    exe.linkSystemLibrary("SDL2");
+    // SDL2 is loaded at runtime by media_sdl.c, only its headers are needed
+    if (b.host.result.os.tag == .linux) {
+        exe.linkSystemLibrary("rt"); // shm_open on older glibc
+        exe.linkSystemLibrary("dl"); // dlopen on older glibc
+        exe.linkSystemLibrary("pthread"); // worker threads on older glibc
+    }
     exe.linkLibC();
 
     b.installArtifact(exe);
+
+    const trace_tool = b.addExecutable(.{
+        .name = "chippy-trace",
+        .target = b.host,
+    });
+    for ([_][]const u8{ "tracetool.c", "trace.c", "lz.c" }) |source| {
+        trace_tool.addCSourceFile(.{ .file = b.path(source), .flags = flags.items });
+    }
+    trace_tool.linkLibC();
+
+    b.installArtifact(trace_tool);
+
+    const view_tool = b.addExecutable(.{
+        .name = "chippy-view",
+        .target = b.host,
+    });
+    for ([_][]const u8{ "streamview.c", "stream.c", "display.c" }) |source| {
+        view_tool.addCSourceFile(.{ .file = b.path(source), .flags = flags.items });
+    }
+    view_tool.linkLibC();
+
+    b.installArtifact(view_tool);
+
+    const shm_tool = b.addExecutable(.{
+        .name = "chippy-shm",
+        .target = b.host,
+    });
+    for ([_][]const u8{ "shmtool.c", "shm.c", "display.c" }) |source| {
+        shm_tool.addCSourceFile(.{ .file = b.path(source), .flags = flags.items });
+    }
+    if (b.host.result.os.tag == .linux)
+        shm_tool.linkSystemLibrary("rt");
+    shm_tool.linkLibC();
+
+    b.installArtifact(shm_tool);
+
+    const coord_tool = b.addExecutable(.{
+        .name = "chippy-coord",
+        .target = b.host,
+    });
+    for ([_][]const u8{ "coord.c", "work.c", "quirks.c", "inputlog.c" }) |source| {
+        coord_tool.addCSourceFile(.{ .file = b.path(source), .flags = flags.items });
+    }
+    coord_tool.linkLibC();
+
+    b.installArtifact(coord_tool);
+
+    if (fuzz) {
+        const fuzz_tool = b.addExecutable(.{
+            .name = "chippy-fuzz",
+            .target = b.host,
+        });
+        for ([_][]const u8{ "fuzz.c", "cpu.c", "trace.c", "lz.c", "debug.c", "profile.c" }) |source| {
+            fuzz_tool.addCSourceFile(.{ .file = b.path(source), .flags = flags.items });
+        }
+        fuzz_tool.linkLibC();
+
+        b.installArtifact(fuzz_tool);
+    }
 }
@@ -1,14 +1,197 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
 #include "media.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
+#include "debug.h"
+#include "quirks.h"
+#include "sched.h"
+#include "stream.h"
+#include "shm.h"
+#include "export.h"
+#include "inputlog.h"
+#include "work.h"
 
 struct chip8_media media;
 struct chip8 cpu;
+struct chip8_stats stats;
+struct chip8_trace trace;
+struct chip8_debug debugger;
+struct chip8_stream stream;
+struct chip8_shm shm;
+struct chip8_export export;
+struct input_log input_rec;
+struct input_log input_replay;
+uint8_t packed[DISPLAY_FRAME_SIZE]; // display handed to media, stream and export
+uint8_t packed_tile[DISPLAY_FRAME_SIZE]; // other sessions on the wall
+#ifdef CHIPPY_PROFILE
+struct chip8_profile profile;
+#endif
 
-#define NO_CYCLES (500 / 60)
+#define NO_CYCLES CPU_TICK_CYCLES // per frame, one timer tick
+#define STATS_INTERVAL_US 1000000
+#define MAX_SESSIONS 4096
+
+// --sessions runs copies of the ROM on the scheduler, session 0 is cpu
+// and the only one shown
+struct chip8 sessions[MAX_SESSIONS];
+struct sched_vm sched_vms[MAX_SESSIONS];
+uint32_t sched_run_list[MAX_SESSIONS];
+uint32_t sched_heap[MAX_SESSIONS];
+struct sched sched;
+
+#ifdef CHIPPY_PROFILE
+// writes the flat profile to path and the folded stacks to path.folded
+static void write_profile(const char *path)
+{
+    char folded_path[512];
+    FILE *fs = fopen(path, "w");
+    if(fs == NULL)
+    {
+        printf("Failed to write profile %s\n", path);
+        return;
+    }
+    profile_dump_flat(&profile, fs);
+    fclose(fs);
+
+    snprintf(folded_path, sizeof(folded_path), "%s.folded", path);
+    fs = fopen(folded_path, "w");
+    if(fs == NULL)
+    {
+        printf("Failed to write profile %s\n", folded_path);
+        return;
+    }
+    profile_dump_folded(&profile, fs);
+    fclose(fs);
+}
+#endif
+
+// The state hash check would take a loop polling for a key as a hang
+// while the replayed input still has key changes to come
+static void update_halt_check(uint8_t halt_check)
+{
+    cpu.halt_check = input_replay.pending ? halt_check & ~CPU_HALT_HASH : halt_check;
+}
+
+// Runs frames without media as fast as possible, the keys come from the
+// replayed input log, returns the number of frames run
+static uint64_t run_headless(uint64_t frames, int replay)
+{
+    uint8_t halt_check = cpu.halt_check;
+    uint64_t frame;
+
+    update_halt_check(halt_check);
+    for(frame=0; frame<frames && cpu.status == CPU_OK; frame++)
+    {
+        cpu_run(&cpu, NO_CYCLES);
+
+        cpu_set_keys(&cpu, replay ? input_log_keys(&input_replay, frame) : 0);
+        update_halt_check(halt_check);
+
+        display_pack(&cpu.disp, packed);
+        export_frame(&export, packed);
+    }
+    return frame;
+}
+
+static int same_state(const struct chip8 *a, const struct chip8 *b)
+{
+    return memcmp(a->mem, b->mem, sizeof(a->mem)) == 0
+        && memcmp(a->v, b->v, sizeof(a->v)) == 0
+        && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0
+        && memcmp(a->disp.rows, b->disp.rows, sizeof(a->disp.rows)) == 0
+        && a->disp.hires == b->disp.hires && a->planes == b->planes
+        && a->i == b->i && a->pc == b->pc && a->sp == b->sp
+        && a->cycles == b->cycles && a->dt_end == b->dt_end
+        && a->st_end == b->st_end && a->rng == b->rng
+        && a->wait_key == b->wait_key && a->status == b->status;
+}
+
+// Runs frames from the current state once instruction by instruction
+// and once with cpu_run, prints both speeds, returns 0 if the results match
+static int run_bench(uint64_t frames, int cycles)
+{
+    static struct chip8 plain;
+    static struct chip8 fused;
+    uint64_t instrs = 0;
+
+    cpu_set_tick_cycles(&cpu, (uint32_t)cycles);
+    plain = cpu;
+    uint64_t start_us = media_clock_us(NULL);
+    for(uint64_t f=0; f<frames; f++)
+    {
+        for(int i=0; i<cycles; i++)
+        {
+            instrs += !(plain.wait_key || plain.paused || plain.status);
+            cpu_cycle(&plain);
+        }
+    }
+    uint64_t plain_us = media_clock_us(NULL) - start_us;
+
+    fused = cpu;
+    start_us = media_clock_us(NULL);
+    for(uint64_t f=0; f<frames; f++)
+    {
+        cpu_run(&fused, (uint64_t)cycles);
+    }
+    uint64_t fused_us = media_clock_us(NULL) - start_us;
+
+    int same = same_state(&plain, &fused);
+    printf("%llu frames, %llu instructions\n", (unsigned long long)frames, (unsigned long long)instrs);
+    printf("cpu_cycle %8.1f M instructions/s\n", plain_us ? instrs / (double)plain_us : 0.0);
+    printf("cpu_run   %8.1f M instructions/s, %.2fx\n", fused_us ? instrs / (double)fused_us : 0.0,
+        fused_us ? plain_us / (double)fused_us : 0.0);
+    printf("final states %s\n", same ? "match" : "DIFFER");
+    return !same;
+}
+
+// also registered with atexit for the early exits
+static void close_trace(void)
+{
+    if(cpu.trace == NULL)
+        return;
+    cpu.trace = NULL;
+    if(trace_close(&trace) != 0)
+        printf("Failed to write trace\n");
+    else
+        printf("Traced %llu instructions, %llu bytes raw, %llu bytes written\n",
+            (unsigned long long)trace.count,
+            (unsigned long long)trace.bytes_raw,
+            (unsigned long long)trace.bytes_written);
+}
 
 int main(int argc, char* argv[])
 {
+    const char *rom_path = NULL;
+    const char *profile_path = NULL;
+    const char *stats_path = NULL;
+    const char *trace_path = NULL;
+    const char *stream_addr = NULL;
+    const char *shm_name = NULL;
+    const char *export_path = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    int export_format = -1;
+    int dedup = 0;
+    uint8_t halt_check = 0;
+    const char *worker_addr = NULL;
+    long long bench_frames = 0;
+    int bench_cycles = NO_CYCLES;
+    int threads = 0;
+    uint32_t seed = 1234;
+    const char *quirks_db = "quirks.db";
+    int quirks = -1;
+    int overlay = 0;
+    int session_count = 0;
+    int wall = 0;
+    const char *media_spec = "sdl";
+    int frame_limit = 0;
+
+    debug_init(&debugger);
+
     // cpu initialization
 
     cpu_init(&cpu);
@@ -20,43 +203,378 @@ int main(int argc, char* argv[])
         printf("\n");
     }
 
-    if(argc > 1)
-        cpu_load_rom(&cpu, argv[1]);
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "--profile") == 0 && i+1 < argc)
+            profile_path = argv[++i];
+        else if(strcmp(argv[i], "--stats") == 0 && i+1 < argc)
+            stats_path = argv[++i];
+        else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc)
+            trace_path = argv[++i];
+        else if(strcmp(argv[i], "--stream") == 0 && i+1 < argc)
+            stream_addr = argv[++i];
+        else if(strcmp(argv[i], "--shm") == 0 && i+1 < argc)
+            shm_name = argv[++i];
+        else if(strcmp(argv[i], "--export") == 0 && i+1 < argc)
+            export_path = argv[++i];
+        else if(strcmp(argv[i], "--export-format") == 0 && i+1 < argc)
+        {
+            export_format = export_parse_format(argv[++i]);
+            if(export_format < 0)
+            {
+                printf("Unknown export format %s, use raw, pbm, ppm or y4m\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--dedup") == 0)
+            dedup = 1;
+        else if(strcmp(argv[i], "--record-input") == 0 && i+1 < argc)
+            record_path = argv[++i];
+        else if(strcmp(argv[i], "--replay-input") == 0 && i+1 < argc)
+            replay_path = argv[++i];
+        else if(strcmp(argv[i], "--break") == 0 && i+1 < argc)
+        {
+            if(debug_add(&debugger, argv[++i]) != 0)
+            {
+                printf("Invalid watch %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--quirks") == 0 && i+1 < argc)
+        {
+            quirks = quirks_parse(argv[++i]);
+            if(quirks < 0)
+            {
+                printf("Unknown quirks %s, use legacy, vip, chip48, schip or modern\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--quirks-db") == 0 && i+1 < argc)
+            quirks_db = argv[++i];
+        else if(strcmp(argv[i], "--sessions") == 0 && i+1 < argc)
+        {
+            session_count = atoi(argv[++i]);
+            if(session_count < 1 || session_count > MAX_SESSIONS)
+            {
+                printf("Sessions must be 1 to %d\n", MAX_SESSIONS);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--debug") == 0)
+            cpu.paused = 1;
+        else if(strcmp(argv[i], "--overlay") == 0)
+            overlay = 1;
+        else if(strcmp(argv[i], "--wall") == 0)
+            wall = 1;
+        else if(strcmp(argv[i], "--term") == 0)
+            media_spec = "term";
+        else if(strcmp(argv[i], "--media") == 0 && i+1 < argc)
+            media_spec = argv[++i];
+        else if(strcmp(argv[i], "--bench") == 0 && i+1 < argc)
+            bench_frames = atoll(argv[++i]);
+        else if(strcmp(argv[i], "--bench-cycles") == 0 && i+1 < argc)
+            bench_cycles = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--worker") == 0 && i+1 < argc)
+            worker_addr = argv[++i];
+        else if(strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--seed") == 0 && i+1 < argc)
+            seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--halt") == 0)
+            halt_check = CPU_HALT_JUMP;
+        else if(strcmp(argv[i], "--halt-hash") == 0)
+            halt_check = CPU_HALT_JUMP | CPU_HALT_HASH;
+        else if(strcmp(argv[i], "--frames") == 0 && i+1 < argc)
+            frame_limit = atoi(argv[++i]);
+        else
+            rom_path = argv[i];
+    }
+
+    // the coordinator sends the ROMs
+    if(worker_addr != NULL)
+        return work_serve(worker_addr, threads);
+
+    if(rom_path != NULL)
+    {
+        int rom_size = cpu_load_rom(&cpu, rom_path);
+        if(rom_size < 0)
+        {
+            printf("Failed to load ROM %s\n", rom_path);
+            return 1;
+        }
+        uint64_t hash = quirks_rom_hash(cpu.mem + CPU_ROM_ADDR, rom_size);
+        if(quirks < 0)
+            quirks = quirks_lookup(quirks_db, hash);
+        printf("ROM hash %016llx\n", (unsigned long long)hash);
+    }
+    if(quirks >= 0)
+        cpu_set_quirks(&cpu, quirks);
+    printf("Quirks %s\n", quirks_name(cpu.quirks));
+    cpu.halt_check = halt_check;
+    cpu_seed(&cpu, seed);
+
+    if(bench_frames > 0)
+        return run_bench((uint64_t)bench_frames, bench_cycles);
+
+    debug_update(&debugger, &cpu);
+
+    if(trace_path != NULL)
+    {
+        if(trace_open(&trace, trace_path, &cpu) != 0)
+        {
+            printf("Failed to open trace %s\n", trace_path);
+            return 1;
+        }
+        cpu.trace = &trace;
+        atexit(close_trace);
+    }
+
+    if(stream_addr != NULL && stream_listen(&stream, stream_addr) != 0)
+    {
+        printf("Failed to listen on %s\n", stream_addr);
+        return 1;
+    }
+
+    if(shm_name != NULL && shm_create(&shm, shm_name) != 0)
+    {
+        printf("Failed to create shared memory %s\n", shm_name);
+        return 1;
+    }
+
+    if(profile_path != NULL)
+    {
+#ifdef CHIPPY_PROFILE
+        profile_init(&profile);
+        cpu.profile = &profile;
+#else
+        printf("Profiling not compiled in, build with -Dprofile=true\n");
+        profile_path = NULL;
+#endif
+    }
+
+    if(replay_path != NULL && input_log_replay(&input_replay, replay_path) != 0)
+    {
+        printf("Failed to open input log %s\n", replay_path);
+        return 1;
+    }
+
+    if(record_path != NULL && input_log_record(&input_rec, record_path) != 0)
+    {
+        printf("Failed to create input log %s\n", record_path);
+        return 1;
+    }
+
+    // headless export
+
+    if(export_path != NULL)
+    {
+        // the format defaults to the file extension
+        const char *ext = strrchr(export_path, '.');
+        if(export_format < 0)
+            export_format = ext != NULL ? export_parse_format(ext + 1) : -1;
+        if(export_format < 0)
+            export_format = EXPORT_RAW;
+        // y4m has no way to repeat a frame that players understand
+        if(dedup && export_format == EXPORT_Y4M)
+        {
+            printf("--dedup works with raw, pbm and ppm only\n");
+            return 1;
+        }
+        if(export_open(&export, export_path, export_format, dedup) != 0)
+        {
+            printf("Failed to create %s\n", export_path);
+            return 1;
+        }
+
+        uint64_t frames = run_headless(frame_limit > 0 ? (uint64_t)frame_limit : 3600,
+            replay_path != NULL);
+        if(cpu.status != CPU_OK)
+        {
+            printf("CPU stopped: %s at %03X\n", cpu_status_name(cpu.status), cpu.pc);
+            cpu_dump_state(&cpu);
+        }
+        if(export_close(&export) != 0)
+            printf("Failed to write %s\n", export_path);
+        printf("Exported %llu frames, %llu written, %llu bytes\n",
+            (unsigned long long)frames,
+            (unsigned long long)export.written,
+            (unsigned long long)export.bytes);
+
+        input_log_close(&input_replay);
+        input_log_close(&input_rec);
+        close_trace();
+#ifdef CHIPPY_PROFILE
+        if(profile_path != NULL)
+            write_profile(profile_path);
+#endif
+        return 0;
+    }
 
     // media initialization
 
-    if (media_init(&media) != 0)
+    // the debugger prompt needs stdin in line mode
+    if (strcmp(media_spec, "term") == 0 && (cpu.paused || debugger.count > 0))
+    {
+        printf("The term media can't be combined with the debugger\n");
+        return 1;
+    }
+    if (media_init(&media, media_spec) != 0)
         exit(0);
 
     // main loop
 
     uint32_t ms_start = 0;// = media_ms_elapsed(&media);
+    uint64_t us_start = media_us_elapsed(&media);
+    uint64_t us_last_report = us_start;
+    uint8_t status_reported = CPU_OK;
+    uint64_t frame = 0;
+
+    stats_init(&stats, us_start);
+
+    if(session_count > 0)
+    {
+        sched_init(&sched, sched_vms, sched_run_list, sched_heap, MAX_SESSIONS);
+        sched_add(&sched, &cpu, us_start);
+        for(int i=1; i<session_count; i++)
+        {
+            sessions[i] = cpu;
+            cpu_seed(&sessions[i], seed + (uint32_t)i);
+            sessions[i].trace = NULL;
+            sessions[i].debug = NULL;
+#ifdef CHIPPY_PROFILE
+            sessions[i].profile = NULL;
+#endif
+            if(cpu.debug != NULL)
+                sessions[i].instr_table = debugger.table;
+            sched_add(&sched, &sessions[i], us_start);
+        }
+        printf("Running %d sessions\n", session_count);
+    }
+
+    if(wall)
+    {
+        if(session_count == 0)
+            session_count = 1;
+        if(session_count > MEDIA_WALL_MAX)
+            printf("Wall shows the first %d sessions\n", MEDIA_WALL_MAX);
+        wall = session_count < MEDIA_WALL_MAX ? session_count : MEDIA_WALL_MAX;
+        if(media_wall_init(&media, wall) != 0)
+        {
+            printf("The %s media has no wall\n", media.backend->name);
+            exit(0);
+        }
+    }
 
-    while (!media_poll_exit_requested(&media))
+    while (!media_poll_exit_requested(&media)
+        && (frame_limit == 0 || stats.frames < (uint64_t)frame_limit)
+        && !(cpu.status == CPU_HALTED && session_count == 0))
     {
+        if (cpu.paused && debug_prompt(&debugger, &cpu))
+            break;
+
         ms_start = media_ms_elapsed(&media);
+        us_start = media_us_elapsed(&media);
+
+        uint32_t cycles = 0;
+        if (session_count > 0)
+            cycles = (uint32_t)sched_run(&sched, us_start);
+        else
+        {
+            cycles = (uint32_t)cpu_run(&cpu, NO_CYCLES);
+        }
+        if (cpu.status != status_reported)
+        {
+            status_reported = cpu.status;
+            printf("CPU stopped: %s at %03X\n", cpu_status_name(cpu.status), cpu.pc);
+            cpu_dump_state(&cpu);
+        }
+        media_set_buzzer(&media, cpu_get_st(&cpu) > 0);
+
+        if (stream_addr != NULL)
+            stream_poll(&stream, us_start);
+
+        if (shm_name != NULL && shm_poll(&shm))
+        {
+            cpu_reset(&cpu);
+            if (rom_path != NULL)
+                cpu_load_rom(&cpu, rom_path);
+            status_reported = CPU_OK;
+            if (session_count > 0)
+                sched_wake(&sched, 0, us_start);
+        }
 
-        for(int i=0; i<NO_CYCLES;i++)
-            cpu_cycle(&cpu);
-        cpu_tick60hz(&cpu);
-        media_set_buzzer(&media, cpu.st > 0);
+        uint16_t keys = stream.keys | shm.keys;
+        if (replay_path != NULL)
+        {
+            keys |= input_log_keys(&input_replay, frame);
+            update_halt_check(halt_check);
+        }
+        for(uint8_t i=0; i<0x10; i++)
+        {
+            if (media_poll_key_down(&media, i))
+                keys |= (uint16_t)(1 << i);
+        }
+        if (record_path != NULL)
+            input_log_write(&input_rec, frame, keys);
+        frame++;
 
         for(uint8_t i=0; i<0x10; i++)
         {
-            int key_down = media_poll_key_down(&media, i);
-            cpu_set_key_state(&cpu, i, key_down);
+            int key_down = keys >> i & 1;
+            if (session_count > 0)
+                sched_key(&sched, 0, i, key_down, us_start);
+            else
+                cpu_set_key_state(&cpu, i, key_down);
         }
 
-        for (int y = 0; y < TEXTURE_HEIGHT; ++y)
+        display_pack(&cpu.disp, packed);
+        if (wall)
         {
-            for (int x = 0; x < TEXTURE_WIDTH; ++x)
+            media_wall_update(&media, 0, packed);
+            for (int i = 1; i < wall; i++)
             {
-                media_set_pixel(&media, x, y,
-                    cpu_get_pixel(&cpu, x, y));
+                display_pack(&sessions[i].disp, packed_tile);
+                media_wall_update(&media, i, packed_tile);
             }
+            media_wall_render(&media);
+        }
+        else if (overlay)
+        {
+            struct media_graph graph;
+            graph.frame_us = stats.frame_us;
+            graph.count = stats.frames < STATS_HISTORY ? (int)stats.frames : STATS_HISTORY;
+            graph.pos = stats.pos;
+            graph.budget_us = STATS_FRAME_US;
+            media_present(&media, packed, &graph);
         }
+        else
+            media_present(&media, packed, NULL);
+
+        if (stream_addr != NULL)
+            stream_frame(&stream, packed, us_start);
 
-        media_render(&media);
+        if (shm_name != NULL)
+            shm_publish(&shm, &cpu);
+
+        stats_frame(&stats, us_start,
+            (uint32_t)(media_us_elapsed(&media) - us_start), cycles);
+
+        if (us_start - us_last_report >= STATS_INTERVAL_US)
+        {
+            us_last_report = us_start;
+            if (stats_path != NULL && stats_write_file(&stats, &media.stats, stats_path) != 0)
+                printf("Failed to write stats %s\n", stats_path);
+            if (overlay)
+            {
+                char title[128];
+                snprintf(title, sizeof(title), "Chippy - %u IPS, frame p50 %.1f ms p99 %.1f ms, %llu dropped",
+                    stats.ips,
+                    stats_percentile(&stats, stats.frame_us, 50) / 1000.0,
+                    stats_percentile(&stats, stats.frame_us, 99) / 1000.0,
+                    (unsigned long long)stats.frames_dropped);
+                media_set_title(&media, title);
+            }
+        }
 
         uint32_t ms_elapsed = media_ms_elapsed(&media) - ms_start;
         if (ms_elapsed < 16)
@@ -69,5 +587,29 @@ int main(int argc, char* argv[])
 
     media_close(&media);
 
+    input_log_close(&input_replay);
+    input_log_close(&input_rec);
+
+    close_trace();
+
+    shm_close(&shm);
+
+    if(stream_addr != NULL)
+    {
+        stream_close(&stream);
+        printf("Streamed %llu frames, %llu bytes (%llu as packed displays), %llu skipped, rtt avg %llu us max %u us\n",
+            (unsigned long long)stream.frames,
+            (unsigned long long)stream.bytes_sent,
+            (unsigned long long)stream.bytes_raw,
+            (unsigned long long)stream.frames_busy,
+            (unsigned long long)(stream.acks ? stream.rtt_us_sum / stream.acks : 0),
+            stream.rtt_us_max);
+    }
+
+#ifdef CHIPPY_PROFILE
+    if(profile_path != NULL)
+        write_profile(profile_path);
+#endif
+
     return 0;
 }
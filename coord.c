@@ -0,0 +1,475 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "work.h"
+#include "quirks.h"
+#include "inputlog.h"
+
+// chippy-coord, hands out batch runs to chippy --worker processes
+//   chippy-coord [options] ROM...
+//   --listen ADDR         where workers connect, default tcp:7878
+//   --frames N            frame budget per job, default 3600
+//   --cycles N            instructions per frame, default 8
+//   --seeds N             jobs per ROM with the seeds 1..N, default 1
+//   --quirks NAME         quirk profile, default legacy
+//   --halt, --halt-hash   stop hung ROMs early, see chippy
+//   --replay-input FILE   keys for every job, from chippy --record-input
+// Prints a line per finished job:
+//   ROM SEED STATUS PC FRAMES CYCLES DISPLAY-HASH
+
+#define COORD_MAX_ROMS 256
+#define COORD_MAX_JOBS 65536
+#define COORD_MAX_WORKERS 64
+#define COORD_MAX_OUTSTANDING 128 // 2 per thread of a worker, it runs up to 64
+#define COORD_OUT_SIZE (64 * 1024)
+
+struct coord_rom
+{
+    const char *path;
+    uint64_t hash;
+    uint16_t len;
+    uint8_t data[WORK_MAX_ROM];
+};
+
+struct coord_job
+{
+    uint16_t rom;
+    int8_t worker; // -1 if not handed out
+    uint8_t done;
+    uint32_t seed;
+};
+
+// The sockets don't block, so a worker which doesn't read or sends half a
+// message can't stall the others. Messages wait in the buffers; jobs are
+// only handed out while they fit, ROM requests that don't fit wait in
+// roms_asked (a worker asks at most once per outstanding job).
+struct coord_worker
+{
+    int fd; // -1 if unused
+    uint8_t hello; // sent its hello, gets jobs
+    uint16_t threads;
+    uint32_t outstanding; // jobs handed out and not done
+    uint32_t in_len;
+    uint32_t out_pos;
+    uint32_t out_len;
+    uint16_t roms_asked;
+    uint16_t rom_queue[COORD_MAX_OUTSTANDING];
+    uint8_t in[WORK_HEADER + WORK_MAX_MSG];
+    uint8_t out[COORD_OUT_SIZE];
+};
+
+// enum cpu_status, without linking the interpreter
+static const char *const status_names[] =
+{
+    "ok", "stack-overflow", "stack-underflow", "halted", "bad-opcode"
+};
+
+static struct coord_rom roms[COORD_MAX_ROMS];
+static struct coord_job jobs[COORD_MAX_JOBS];
+static struct coord_worker workers[COORD_MAX_WORKERS];
+static struct work_job job_template;
+static uint8_t msg[WORK_MAX_MSG];
+
+static int rom_count;
+static uint32_t job_count;
+static uint32_t jobs_done;
+static uint32_t next_job; // no job before it waits for a worker
+static uint64_t rom_bytes_sent;
+
+static int load_rom(struct coord_rom *rom, const char *path)
+{
+    FILE *fs = fopen(path, "rb");
+    if(fs == NULL)
+        return 1;
+    size_t len = fread(rom->data, 1, WORK_MAX_ROM, fs);
+    int too_big = fgetc(fs) != EOF;
+    fclose(fs);
+    if(len == 0 || too_big)
+        return 1;
+    rom->path = path;
+    rom->len = (uint16_t)len;
+    rom->hash = quirks_rom_hash(rom->data, len);
+    return 0;
+}
+
+static int load_events(const char *path)
+{
+    struct input_log log;
+    uint64_t frame;
+    uint16_t keys;
+
+    if(input_log_replay(&log, path) != 0)
+        return 1;
+    while(input_log_next(&log, &frame, &keys))
+    {
+        if(job_template.event_count == WORK_MAX_EVENTS || frame > UINT32_MAX)
+        {
+            printf("%s has more than %d key changes\n", path, WORK_MAX_EVENTS);
+            input_log_close(&log);
+            return 1;
+        }
+        job_template.events[job_template.event_count].frame = (uint32_t)frame;
+        job_template.events[job_template.event_count].keys = keys;
+        job_template.event_count++;
+    }
+    input_log_close(&log);
+    return 0;
+}
+
+// Puts the jobs of a lost worker back
+static void drop_worker(int w)
+{
+    if(workers[w].hello)
+        printf("Worker %d disconnected\n", w);
+    close(workers[w].fd);
+    workers[w].fd = -1;
+    for(uint32_t j=0; j<job_count; j++)
+    {
+        if(jobs[j].worker == w && !jobs[j].done)
+        {
+            jobs[j].worker = -1;
+            if(j < next_job)
+                next_job = j;
+        }
+    }
+}
+
+// Returns where the payload of a len byte message goes in the output
+// buffer, or NULL if it doesn't fit
+static uint8_t *reserve(struct coord_worker *wk, uint8_t type, size_t len)
+{
+    if(wk->out_pos > 0)
+    {
+        memmove(wk->out, wk->out + wk->out_pos, wk->out_len - wk->out_pos);
+        wk->out_len -= wk->out_pos;
+        wk->out_pos = 0;
+    }
+    if(wk->out_len + WORK_HEADER + len > COORD_OUT_SIZE)
+        return NULL;
+    uint8_t *p = wk->out + wk->out_len;
+    work_put_header(p, type, len);
+    wk->out_len += (uint32_t)(WORK_HEADER + len);
+    return p + WORK_HEADER;
+}
+
+static int queue_rom(struct coord_worker *wk, int r)
+{
+    uint8_t *p = reserve(wk, WORK_ROM, 8 + (size_t)roms[r].len);
+    if(p == NULL)
+        return 1;
+    for(int k=0; k<8; k++)
+        p[k] = (uint8_t)(roms[r].hash >> (8 * k));
+    memcpy(p + 8, roms[r].data, roms[r].len);
+    rom_bytes_sent += roms[r].len;
+    return 0;
+}
+
+// Writes what the socket takes, returns 1 if the worker is gone
+static int flush_worker(int w)
+{
+    struct coord_worker *wk = &workers[w];
+    for(;;)
+    {
+        while(wk->roms_asked > 0 && queue_rom(wk, wk->rom_queue[0]) == 0)
+        {
+            wk->roms_asked--;
+            memmove(wk->rom_queue, wk->rom_queue + 1, wk->roms_asked * sizeof(wk->rom_queue[0]));
+        }
+        if(wk->out_pos == wk->out_len)
+            return 0;
+        ssize_t n = write(wk->fd, wk->out + wk->out_pos, wk->out_len - wk->out_pos);
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if(n <= 0)
+        {
+            drop_worker(w);
+            return 1;
+        }
+        wk->out_pos += (uint32_t)n;
+    }
+}
+
+static void accept_worker(int listen_fd)
+{
+    int fd = work_accept(listen_fd);
+    if(fd < 0)
+        return;
+    for(int w=0; w<COORD_MAX_WORKERS; w++)
+    {
+        struct coord_worker *wk = &workers[w];
+        if(wk->fd >= 0)
+            continue;
+        // the hello comes through poll like everything else
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        wk->fd = fd;
+        wk->hello = 0;
+        wk->threads = 0;
+        wk->outstanding = 0;
+        wk->in_len = 0;
+        wk->out_pos = 0;
+        wk->out_len = 0;
+        wk->roms_asked = 0;
+        return;
+    }
+    close(fd);
+}
+
+// Hands out jobs until every worker has 2 per thread
+static void dispatch(void)
+{
+    for(int w=0; w<COORD_MAX_WORKERS; w++)
+    {
+        struct coord_worker *wk = &workers[w];
+        while(wk->fd >= 0 && wk->outstanding < 2u * wk->threads)
+        {
+            while(next_job < job_count && (jobs[next_job].worker >= 0 || jobs[next_job].done))
+                next_job++;
+            if(next_job == job_count)
+                return;
+
+            struct coord_job *job = &jobs[next_job];
+            job_template.id = next_job;
+            job_template.rom_hash = roms[job->rom].hash;
+            job_template.seed = job->seed;
+            size_t len = work_encode_job(&job_template, msg);
+            uint8_t *p = reserve(wk, WORK_JOB, len);
+            if(p == NULL)
+                break;
+            memcpy(p, msg, len);
+            job->worker = (int8_t)w;
+            wk->outstanding++;
+        }
+        if(wk->fd >= 0)
+            flush_worker(w);
+    }
+}
+
+// Returns 1 if the worker was dropped
+static int handle_message(int w, uint8_t type, const uint8_t *payload, uint32_t len)
+{
+    struct coord_worker *wk = &workers[w];
+    struct work_result res;
+
+    if(!wk->hello)
+    {
+        if(type == WORK_HELLO && len == 2)
+        {
+            wk->hello = 1;
+            wk->threads = (uint16_t)(payload[0] | payload[1] << 8);
+            if(wk->threads > COORD_MAX_OUTSTANDING / 2)
+                wk->threads = COORD_MAX_OUTSTANDING / 2;
+            printf("Worker %d connected with %d threads\n", w, wk->threads);
+            return 0;
+        }
+    }
+    else if(type == WORK_NEED_ROM && len == 8)
+    {
+        uint64_t hash = 0;
+        for(int k=7; k>=0; k--)
+            hash = hash << 8 | payload[k];
+        for(int r=0; r<rom_count; r++)
+        {
+            if(roms[r].hash != hash)
+                continue;
+            if(wk->roms_asked == 0 && queue_rom(wk, r) == 0)
+                return 0;
+            if(wk->roms_asked == COORD_MAX_OUTSTANDING)
+                break;
+            wk->rom_queue[wk->roms_asked++] = (uint16_t)r;
+            return 0;
+        }
+    }
+    else if(type == WORK_RESULT && work_decode_result(payload, len, &res) == 0
+        && res.id < job_count && jobs[res.id].worker == w && !jobs[res.id].done)
+    {
+        struct coord_job *job = &jobs[res.id];
+        job->done = 1;
+        jobs_done++;
+        wk->outstanding--;
+        printf("%s %u %s %03X %u %llu %016llx\n", roms[job->rom].path, job->seed,
+            res.status <= CPU_BAD_OPCODE ? status_names[res.status] : "?", res.pc, res.frames,
+            (unsigned long long)res.cycles, (unsigned long long)res.disp_hash);
+        return 0;
+    }
+    printf("Bad message from worker %d\n", w);
+    drop_worker(w);
+    return 1;
+}
+
+// Reads what arrived and handles the complete messages
+static void read_worker(int w)
+{
+    struct coord_worker *wk = &workers[w];
+    for(;;)
+    {
+        ssize_t n = read(wk->fd, wk->in + wk->in_len, sizeof(wk->in) - wk->in_len);
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(n <= 0)
+        {
+            drop_worker(w);
+            return;
+        }
+        wk->in_len += (uint32_t)n;
+
+        uint32_t pos = 0;
+        while(wk->in_len - pos >= WORK_HEADER)
+        {
+            uint8_t type;
+            uint32_t len = work_get_header(wk->in + pos, &type);
+            if(len > WORK_MAX_MSG)
+            {
+                printf("Bad message from worker %d\n", w);
+                drop_worker(w);
+                return;
+            }
+            if(wk->in_len - pos < WORK_HEADER + len)
+                break;
+            if(handle_message(w, type, wk->in + pos + WORK_HEADER, len) != 0)
+                return;
+            pos += WORK_HEADER + len;
+        }
+        memmove(wk->in, wk->in + pos, wk->in_len - pos);
+        wk->in_len -= pos;
+    }
+    flush_worker(w);
+}
+
+int main(int argc, char **argv)
+{
+    const char *addr = "tcp:7878";
+    uint32_t seeds = 1;
+    int quirks = QUIRKS_LEGACY;
+
+    job_template.frames = 3600;
+    job_template.cycles = 500 / 60;
+
+    int i;
+    for(i=1; i<argc && strncmp(argv[i], "--", 2) == 0; i++)
+    {
+        if(strcmp(argv[i], "--listen") == 0 && i+1 < argc)
+            addr = argv[++i];
+        else if(strcmp(argv[i], "--frames") == 0 && i+1 < argc)
+            job_template.frames = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--cycles") == 0 && i+1 < argc)
+            job_template.cycles = (uint16_t)atoi(argv[++i]);
+        else if(strcmp(argv[i], "--seeds") == 0 && i+1 < argc)
+            seeds = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--quirks") == 0 && i+1 < argc)
+            quirks = quirks_parse(argv[++i]);
+        else if(strcmp(argv[i], "--halt") == 0)
+            job_template.halt_check = CPU_HALT_JUMP;
+        else if(strcmp(argv[i], "--halt-hash") == 0)
+            job_template.halt_check = CPU_HALT_JUMP | CPU_HALT_HASH;
+        else if(strcmp(argv[i], "--replay-input") == 0 && i+1 < argc)
+        {
+            if(load_events(argv[++i]) != 0)
+            {
+                printf("Failed to read input log %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+            break;
+    }
+    if(i == argc || quirks < 0 || seeds == 0)
+    {
+        printf("usage: chippy-coord [--listen ADDR] [--frames N] [--cycles N] [--seeds N]\n"
+               "                    [--quirks NAME] [--halt|--halt-hash] [--replay-input FILE] ROM...\n");
+        return 1;
+    }
+    job_template.quirks = (uint8_t)quirks;
+
+    for(; i<argc; i++)
+    {
+        if(rom_count == COORD_MAX_ROMS || load_rom(&roms[rom_count], argv[i]) != 0)
+        {
+            printf("Failed to load ROM %s\n", argv[i]);
+            return 1;
+        }
+        for(uint32_t s=1; s<=seeds; s++)
+        {
+            if(job_count == COORD_MAX_JOBS)
+            {
+                printf("More than %d jobs\n", COORD_MAX_JOBS);
+                return 1;
+            }
+            jobs[job_count].rom = (uint16_t)rom_count;
+            jobs[job_count].worker = -1;
+            jobs[job_count].seed = s;
+            job_count++;
+        }
+        rom_count++;
+    }
+
+    int listen_fd = work_listen(addr);
+    if(listen_fd < 0)
+    {
+        printf("Failed to listen on %s\n", addr);
+        return 1;
+    }
+    for(int w=0; w<COORD_MAX_WORKERS; w++)
+        workers[w].fd = -1;
+    printf("Waiting for workers on %s, %u jobs\n", addr, job_count);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(jobs_done < job_count)
+    {
+        struct pollfd fds[COORD_MAX_WORKERS + 1];
+        int ids[COORD_MAX_WORKERS];
+        int n = 0;
+        for(int w=0; w<COORD_MAX_WORKERS; w++)
+        {
+            if(workers[w].fd < 0)
+                continue;
+            fds[n].fd = workers[w].fd;
+            fds[n].events = POLLIN;
+            if(workers[w].out_pos < workers[w].out_len)
+                fds[n].events |= POLLOUT;
+            ids[n++] = w;
+        }
+        fds[n].fd = listen_fd;
+        fds[n].events = POLLIN;
+        if(poll(fds, (nfds_t)n + 1, -1) < 0)
+            break;
+
+        for(int f=0; f<n; f++)
+        {
+            if(fds[f].revents & (POLLIN | POLLHUP | POLLERR))
+                read_worker(ids[f]);
+            else if(fds[f].revents & POLLOUT)
+                flush_worker(ids[f]);
+        }
+        if(fds[n].revents & POLLIN)
+            accept_worker(listen_fd);
+        dispatch();
+    }
+
+    for(int w=0; w<COORD_MAX_WORKERS; w++)
+    {
+        if(workers[w].fd < 0)
+            continue;
+        // best effort, whatever is still queued only matters to the worker
+        if(reserve(&workers[w], WORK_QUIT, 0) != NULL && flush_worker(w) != 0)
+            continue;
+        close(workers[w].fd);
+    }
+    close(listen_fd);
+    if(strncmp(addr, "unix:", 5) == 0)
+        unlink(addr + 5);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Finished %u jobs in %.2f s, %llu ROM bytes sent\n",
+        jobs_done, seconds, (unsigned long long)rom_bytes_sent);
+    return 0;
+}
@@ -1,11 +1,19 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include "cpu.h"
+#include "instr.h"
+#include "profile.h"
+#include "trace.h"
+#include "debug.h"
 
-#define BASE_ADDR 0x200
+#define BASE_ADDR CPU_ROM_ADDR
 #define DIGIT_SPRITES_ADDR 0x100
+#define BIG_DIGIT_SPRITES_ADDR 0x150
+
+// Guest addresses wrap around at 4 KiB, every access through I or PC is
+// masked so handlers never touch memory outside of mem.
+#define MEM_MASK (CPU_MEM_SIZE - 1)
 
 static uint8_t digit_sprites[] =
 {
@@ -27,6 +35,27 @@ static uint8_t digit_sprites[] =
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// 8x10 digits of SCHIP (0-9) and XO-CHIP (A-F)
+static uint8_t big_digit_sprites[] =
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
 // n = 0 is the leftmost nibble!
 static uint8_t opcode2nib(uint16_t opcode, int n)
 {
@@ -59,6 +88,38 @@ static uint8_t nibs2byte(uint8_t nib0, uint8_t nib1)
     return (nib0<<4) | nib1;
 }
 
+// Stops the cpu, pc is set back to the failing instruction
+static void cpu_fail(struct chip8 *cpu, enum cpu_status status)
+{
+    cpu->status = status;
+    cpu->pc -= 2;
+}
+
+// Forgets the fused sequences overlapping written memory, the blocks
+// written are hashed again by the halt check
+static void mem_written(struct chip8 *cpu, uint16_t addr, int len)
+{
+    uint16_t first = (addr & MEM_MASK) >> 3;
+    uint16_t last = ((addr + len - 1) & MEM_MASK) >> 3;
+    if(last < first)
+        cpu->mem_hashed = 0;
+    if(first < cpu->dirty_lo)
+        cpu->dirty_lo = first;
+    if(last > cpu->dirty_hi)
+        cpu->dirty_hi = last;
+    // a sequence is at most 6 bytes long
+    for(int k=-5; k<len; k++)
+        cpu->fuse[(addr + k) & MEM_MASK] = 0;
+}
+
+// The deadline of a timer set to value now, it counts down on each tick
+static uint64_t timer_end(struct chip8 *cpu, uint8_t value)
+{
+    if(value == 0)
+        return 0;
+    return cpu->next_tick + (uint64_t)(value - 1) * cpu->tick_cycles;
+}
+
 static void write_with_carry(struct chip8 *cpu, uint8_t dest, uint8_t val, uint8_t carry)
 {
     cpu->v[dest] = val;
@@ -79,7 +140,11 @@ static void instr_0nnn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 static void instr_00e0(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
 {
     //printf("00E0 - CLS\n");
-    memset(cpu->disp, 0, 8*32);
+    // XO-CHIP clears the selected planes only
+    cpu->disp_hashed = 0;
+    for(int p=0; p<DISPLAY_PLANES; p++)
+        if(cpu->planes & (1 << p))
+            memset(cpu->disp.rows[p], 0, sizeof(cpu->disp.rows[p]));
 }
 
 //00EE - RET
@@ -88,9 +153,133 @@ static void instr_00ee(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.
     //printf("00EE - RET\n");
-    assert(cpu->sp > 0 && cpu->sp <= 0xf); 
+    if(cpu->sp == 0)
+    {
+        cpu_fail(cpu, CPU_STACK_UNDERFLOW);
+        return;
+    }
     cpu->pc = cpu->stack[cpu->sp-1];
     cpu->sp--;
+    PROFILE_RET(cpu);
+}
+
+static int disp_width(const struct chip8 *cpu)
+{
+    return cpu->disp.hires ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+}
+
+static int disp_height(const struct chip8 *cpu)
+{
+    return cpu->disp.hires ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+}
+
+// Moves the rows of the selected planes down by n, up if n is negative,
+// the rows coming in are blank
+static void scroll_rows(struct chip8 *cpu, int n)
+{
+    int height = disp_height(cpu);
+    int keep = height - (n < 0 ? -n : n);
+    cpu->disp_hashed = 0;
+    for(int p=0; p<DISPLAY_PLANES; p++)
+    {
+        if(!(cpu->planes & (1 << p)))
+            continue;
+        uint64_t (*rows)[2] = cpu->disp.rows[p];
+        if(n > 0)
+        {
+            memmove(rows + n, rows, keep * sizeof(rows[0]));
+            memset(rows, 0, n * sizeof(rows[0]));
+        }
+        else if(n < 0)
+        {
+            memmove(rows, rows - n, keep * sizeof(rows[0]));
+            memset(rows + keep, 0, -n * sizeof(rows[0]));
+        }
+    }
+}
+
+// Moves the selected planes 4 pixels right or left
+static void scroll_columns(struct chip8 *cpu, int right)
+{
+    int height = disp_height(cpu);
+    cpu->disp_hashed = 0;
+    for(int p=0; p<DISPLAY_PLANES; p++)
+    {
+        if(!(cpu->planes & (1 << p)))
+            continue;
+        for(int y=0; y<height; y++)
+        {
+            uint64_t *row = cpu->disp.rows[p][y];
+            if(right)
+            {
+                row[1] = row[1] >> 4 | row[0] << 60;
+                row[0] >>= 4;
+            }
+            else
+            {
+                row[0] = row[0] << 4 | row[1] >> 60;
+                row[1] <<= 4;
+            }
+            // lores rows end after the first word
+            if(!cpu->disp.hires)
+                row[1] = 0;
+        }
+    }
+}
+
+//00Cn - SCD nibble
+//Scroll the display down by n rows (SCHIP).
+static void instr_00cn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    scroll_rows(cpu, nib2);
+}
+
+//00Dn - SCU nibble
+//Scroll the display up by n rows (XO-CHIP).
+static void instr_00dn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    scroll_rows(cpu, -nib2);
+}
+
+//00FB - SCR
+//Scroll the display right by 4 pixels (SCHIP).
+static void instr_00fb(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    scroll_columns(cpu, 1);
+}
+
+//00FC - SCL
+//Scroll the display left by 4 pixels (SCHIP).
+static void instr_00fc(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    scroll_columns(cpu, 0);
+}
+
+//00FD - EXIT
+//Exit the interpreter (SCHIP).
+static void instr_00fd(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    cpu_fail(cpu, CPU_HALTED);
+}
+
+//00FE - LOW, 00FF - HIGH
+//Switch to the 64x32 or the 128x64 display (SCHIP). Both modes share the
+//rows, so the display is cleared.
+static void set_hires(struct chip8 *cpu, uint8_t hires)
+{
+    memset(cpu->disp.rows, 0, sizeof(cpu->disp.rows));
+    cpu->disp.hires = hires;
+    cpu->disp_hashed = 0;
+}
+
+static void instr_00fe(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    set_hires(cpu, 0);
+}
+
+static void instr_00ff(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    set_hires(cpu, 1);
 }
 
 //1nnn - JP addr
@@ -99,6 +288,10 @@ static void instr_1nnn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //printf("1nnn - JP addr\n");
     uint16_t addr = nibs2addr(0, nib0, nib1, nib2);
+    // a self jump with idle timers loops forever
+    if(addr == (uint16_t)(cpu->pc - 2) && (cpu->halt_check & CPU_HALT_JUMP)
+        && cpu->dt_end <= cpu->cycles && cpu->st_end <= cpu->cycles)
+        cpu->status = CPU_HALTED;
     cpu->pc = addr;
 }
 
@@ -108,11 +301,16 @@ static void instr_2nnn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.
     //printf("2nnn - CALL addr\n");
-    assert(cpu->sp >= 0 && cpu->sp < 0xf);
+    if(cpu->sp == CPU_STACK_SIZE)
+    {
+        cpu_fail(cpu, CPU_STACK_OVERFLOW);
+        return;
+    }
     cpu->sp++;
     cpu->stack[cpu->sp-1] = cpu->pc;
     uint16_t addr = nibs2addr(0, nib0, nib1, nib2);
     cpu->pc = addr;
+    PROFILE_CALL(cpu, addr);
 }
 
 //3xkk - SE Vx, byte
@@ -122,7 +320,9 @@ static void instr_3xkk(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
     //The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.
     //printf("3xkk - SE Vx, byte\n");
     uint8_t kk = nibs2byte(nib1, nib2);
-    if(cpu->v[nib0] == kk)
+    int taken = cpu->v[nib0] == kk;
+    PROFILE_SKIP(cpu, taken);
+    if(taken)
         cpu->pc += 2;
 }
 
@@ -133,7 +333,9 @@ static void instr_4xkk(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
     //The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.
     //printf("4xkk - SNE Vx, byte\n");
     uint8_t kk = nibs2byte(nib1, nib2);
-    if(cpu->v[nib0] != kk)
+    int taken = cpu->v[nib0] != kk;
+    PROFILE_SKIP(cpu, taken);
+    if(taken)
         cpu->pc += 2;
 }
 
@@ -144,7 +346,9 @@ static void instr_5xy0(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.
     //printf("5xy0 - SE Vx, Vy\n");
-    if(cpu->v[nib0] == cpu->v[nib1])
+    int taken = cpu->v[nib0] == cpu->v[nib1];
+    PROFILE_SKIP(cpu, taken);
+    if(taken)
         cpu->pc += 2;
 }
 
@@ -180,30 +384,45 @@ static void instr_8xy0(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 
 //8xy1 - OR Vx, Vy
 //Set Vx = Vx OR Vy.
-static void instr_8xy1(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx. A bitwise OR compares the corrseponding bits from two values, and if either bit is 1, then the same bit in the result is also 1. Otherwise, it is 0.
-    //printf("8xy1 - OR Vx, Vy\n");
-    cpu->v[nib0] |= cpu->v[nib1];
+//Quirk: the COSMAC VIP resets VF afterwards (vfreset)
+//Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx. A bitwise OR compares the corrseponding bits from two values, and if either bit is 1, then the same bit in the result is also 1. Otherwise, it is 0.
+#define INSTR_8XY1(variant, VF_RESET) \
+static void instr_8xy1_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    cpu->v[nib0] |= cpu->v[nib1]; \
+    if(VF_RESET) \
+        cpu->v[0xf] = 0; \
 }
+INSTR_8XY1(plain, 0)
+INSTR_8XY1(vfreset, 1)
 
 //8xy2 - AND Vx, Vy
 //Set Vx = Vx AND Vy.
-static void instr_8xy2(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx. A bitwise AND compares the corrseponding bits from two values, and if both bits are 1, then the same bit in the result is also 1. Otherwise, it is 0.
-    //printf("8xy2 - AND Vx, Vy\n");
-    cpu->v[nib0] &= cpu->v[nib1];
+//Quirk: the COSMAC VIP resets VF afterwards (vfreset)
+//Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx. A bitwise AND compares the corrseponding bits from two values, and if both bits are 1, then the same bit in the result is also 1. Otherwise, it is 0.
+#define INSTR_8XY2(variant, VF_RESET) \
+static void instr_8xy2_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    cpu->v[nib0] &= cpu->v[nib1]; \
+    if(VF_RESET) \
+        cpu->v[0xf] = 0; \
 }
+INSTR_8XY2(plain, 0)
+INSTR_8XY2(vfreset, 1)
 
 //8xy3 - XOR Vx, Vy
 //Set Vx = Vx XOR Vy.
-static void instr_8xy3(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the same, then the corresponding bit in the result is set to 1. Otherwise, it is 0.
-    //printf("8xy3 - XOR Vx, Vy\n");
-    cpu->v[nib0] ^= cpu->v[nib1];
+//Quirk: the COSMAC VIP resets VF afterwards (vfreset)
+//Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the same, then the corresponding bit in the result is set to 1. Otherwise, it is 0.
+#define INSTR_8XY3(variant, VF_RESET) \
+static void instr_8xy3_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    cpu->v[nib0] ^= cpu->v[nib1]; \
+    if(VF_RESET) \
+        cpu->v[0xf] = 0; \
 }
+INSTR_8XY3(plain, 0)
+INSTR_8XY3(vfreset, 1)
 
 //8xy4 - ADD Vx, Vy
 //Set Vx = Vx + Vy, set VF = carry.
@@ -232,16 +451,19 @@ static void instr_8xy5(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 
 //8xy6 - SHR Vx {, Vy}
 //Set Vx = Vx SHR 1.
-static void instr_8xy6(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
-    //printf("8xy6 - SHR Vx {, Vy}\n");
-    write_with_carry(
-        cpu,
-        nib0,
-        cpu->v[nib0] >> 1,
-        cpu->v[nib0] & 0x1);
+//Quirk: the COSMAC VIP shifts Vy into Vx (vy), later interpreters shift Vx in place (vx)
+//If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
+#define INSTR_8XY6(variant, SRC) \
+static void instr_8xy6_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    write_with_carry( \
+        cpu, \
+        nib0, \
+        cpu->v[SRC] >> 1, \
+        cpu->v[SRC] & 0x1); \
 }
+INSTR_8XY6(vx, nib0)
+INSTR_8XY6(vy, nib1)
 
 //8xy7 - SUBN Vx, Vy
 //Set Vx = Vy - Vx, set VF = NOT borrow.
@@ -258,16 +480,19 @@ static void instr_8xy7(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 
 //8xyE - SHL Vx {, Vy}
 //Set Vx = Vx SHL 1.
-static void instr_8xye(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
-    //printf("8xyE - SHL Vx {, Vy}\n");
-    write_with_carry(
-        cpu,
-        nib0,
-        cpu->v[nib1] << 1,
-        (cpu->v[nib1] >> 7) & 0x1);
+//Quirk: the COSMAC VIP shifts Vy into Vx (vy), later interpreters shift Vx in place (vx)
+//If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
+#define INSTR_8XYE(variant, SRC) \
+static void instr_8xye_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    write_with_carry( \
+        cpu, \
+        nib0, \
+        cpu->v[SRC] << 1, \
+        (cpu->v[SRC] >> 7) & 0x1); \
 }
+INSTR_8XYE(vx, nib0)
+INSTR_8XYE(vy, nib1)
 
 //9xy0 - SNE Vx, Vy
 //Skip next instruction if Vx != Vy.
@@ -275,7 +500,9 @@ static void instr_9xy0(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
     //printf("9xy0 - SNE Vx, Vy\n");
-    if(cpu->v[nib0] != cpu->v[nib1])
+    int taken = cpu->v[nib0] != cpu->v[nib1];
+    PROFILE_SKIP(cpu, taken);
+    if(taken)
         cpu->pc += 2;
 }
 
@@ -291,13 +518,16 @@ static void instr_annn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 
 //Bnnn - JP V0, addr
 //Jump to location nnn + V0.
-static void instr_bnnn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //The program counter is set to nnn plus the value of V0.
-    //printf("Bnnn - JP V0, addr\n");
-    uint16_t addr = nibs2addr(0, nib0, nib1, nib2) + cpu->v[0];
-    cpu->pc = addr;
+//Quirk: CHIP-48 and SCHIP read this as Bxnn and add Vx instead (vx)
+//The program counter is set to nnn plus the value of V0.
+#define INSTR_BNNN(variant, REG) \
+static void instr_bnnn_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    uint16_t addr = nibs2addr(0, nib0, nib1, nib2) + cpu->v[REG]; \
+    cpu->pc = addr; \
 }
+INSTR_BNNN(v0, 0)
+INSTR_BNNN(vx, nib0)
 
 //Cxkk - RND Vx, byte
 //Set Vx = random byte AND kk.
@@ -306,64 +536,110 @@ static void instr_cxkk(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
     //The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
     //printf("Cxkk - RND Vx, byte\n");
     uint8_t mask = nibs2byte(nib1, nib2);
-    cpu->v[nib0] = (rand() % 0xff) & mask;
+    // xorshift32, per cpu so runs are reproducible and threads don't share it
+    uint32_t x = cpu->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cpu->rng = x;
+    cpu->v[nib0] = (x % 0xff) & mask;
 }
 
 
-// XOR the bit in memory that represents
-// pixel x, y with 1
-// Return true if the pixel was previously already 1
-static int xor_pixel(struct chip8 *cpu, int x, int y)
+// Where the 16 sprite bits drawn at x land in a display row of width 64
+// or 128, the part past the right edge is cut off or wraps around
+static void sprite_mask(uint16_t bits, int x, int width, int clip, uint64_t mask[2])
 {
-    // Screen is 64 x 32 px, each px is a bit
-    x = x % 64;
-    y = y % 32;
-
-    // Find byte to manipulate the target pixel
-    int target_byte = (y * 8) + (x / 8);
-
-    // Bitmask to manipulate pixel
-    uint8_t value_mask = (uint8_t) 128 >> (x % 8);
-
-    // Do it
-    cpu->disp[target_byte] ^= value_mask;
-
-    // Check if there was a collision
-    return cpu->disp[target_byte] & value_mask;
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+    uint64_t past = 0;
+
+    // as if the row was 128 wide
+    if(x <= 48)
+        hi = (uint64_t)bits << (48 - x);
+    else if(x < 64)
+    {
+        hi = (uint64_t)bits >> (x - 48);
+        lo = (uint64_t)bits << (112 - x);
+    }
+    else if(x <= 112)
+        lo = (uint64_t)bits << (112 - x);
+    else
+    {
+        lo = (uint64_t)bits >> (x - 112);
+        past = (uint64_t)bits << (176 - x);
+    }
+    // a lores row ends after the first word, bits of the second word
+    // wrap to the same positions in the first
+    if(width < DISPLAY_WIDTH)
+    {
+        past = lo;
+        lo = 0;
+    }
+    if(!clip)
+        hi |= past;
+    mask[0] = hi;
+    mask[1] = lo;
 }
 
 //Dxyn - DRW Vx, Vy, nibble
 //Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
-static void instr_dxyn(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+//Dxy0 draws a 16x16 sprite of two bytes per row (SCHIP). The sprite is drawn
+//into every selected plane, the data of plane 1 follows the one of plane 0 (XO-CHIP).
+//Quirk: sprites wrap around the screen edges (wrap) or are cut off there (clip),
+//the start position always wraps. Returns the sprite rows drawn over all planes.
+static int draw_sprite(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2, int clip)
 {
-    //printf("Dxyn - DRW Vx, Vy, nibble\n");
-
-    uint8_t start_x = cpu->v[nib0];
-    uint8_t start_y = cpu->v[nib1];
-
-    cpu->v[0xf] = 0;
-
-    for(int row=0; row<nib2; row++)
+    int width = disp_width(cpu);
+    int height = disp_height(cpu);
+    int x = cpu->v[nib0] & (width - 1);
+    int y = cpu->v[nib1] & (height - 1);
+    int rows = nib2 ? nib2 : 16;
+    uint16_t addr = cpu->i;
+    uint64_t hit = 0;
+    int drawn = 0;
+
+    for(int p=0; p<DISPLAY_PLANES; p++)
     {
-        uint8_t sprite_row = cpu->mem[cpu->i+row];
-        for(int px=0; px<8; px++)
+        if(!(cpu->planes & (1 << p)))
+            continue;
+        drawn += rows;
+        for(int r=0; r<rows; r++)
         {
-            //printf("Checking if sprite_row=0x%02X px=%d is set (&0x%02X)\n", sprite_row, px, (128 >> px));
-
-            if(sprite_row & (128 >> px)) // just bit[px] of the current row
+            uint16_t bits = (uint16_t)(cpu->mem[addr++ & MEM_MASK] << 8);
+            if(nib2 == 0)
+                bits |= cpu->mem[addr++ & MEM_MASK];
+            int row = y + r;
+            if(row >= height)
             {
-                //printf("XORing pixel x=%d, y=%d\n", start_x + px, start_y + row);
-                int x = start_x + px;
-                int y = start_y + row;
-                int result = xor_pixel(cpu, x, y);
-                if(result == 0)
-                {
-                    cpu->v[0xf] = 1;
-                }
+                if(clip)
+                    continue;
+                row -= height;
             }
+            if(bits == 0)
+                continue;
+            uint64_t mask[2];
+            sprite_mask(bits, x, width, clip, mask);
+            uint64_t *dst = cpu->disp.rows[p][row];
+            hit |= (dst[0] & mask[0]) | (dst[1] & mask[1]);
+            dst[0] ^= mask[0];
+            dst[1] ^= mask[1];
+            cpu->dirty_rows[p] |= 1ULL << row;
         }
     }
+    cpu->v[0xf] = hit != 0;
+    return drawn;
+}
+
+#define INSTR_DXYN(variant, CLIP) \
+static void instr_dxyn_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    int drawn = draw_sprite(cpu, nib0, nib1, nib2, CLIP); \
+    (void)drawn; /* only counted with CHIPPY_PROFILE */ \
+    PROFILE_DRW(cpu, drawn, cpu->v[0xf]); \
 }
+INSTR_DXYN(wrap, 0)
+INSTR_DXYN(clip, 1)
 
 //Ex9E - SKP Vx
 //Skip next instruction if key with the value of Vx is pressed.
@@ -372,7 +648,9 @@ static void instr_ex9e(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
     //Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.
     //printf("Ex9E - SKP Vx\n");
     uint16_t mask = 0x1 << cpu->v[nib0];
-    if((cpu->keys & mask) != 0)
+    int taken = (cpu->keys & mask) != 0;
+    PROFILE_SKIP(cpu, taken);
+    if(taken)
     {
         cpu->pc += 2;
     }
@@ -385,19 +663,28 @@ static void instr_exa1(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
     //Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
     //printf("ExA1 - SKNP Vx\n");
     uint16_t mask = 0x1 << cpu->v[nib0];
-    if((cpu->keys & mask) == 0)
+    int taken = (cpu->keys & mask) == 0;
+    PROFILE_SKIP(cpu, taken);
+    if(taken)
     {
         cpu->pc += 2;
     }
 }
 
+//Fn01 - PLANE n
+//Select the planes drawn, cleared and scrolled (XO-CHIP).
+static void instr_fn01(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    cpu->planes = nib0 & ((1 << DISPLAY_PLANES) - 1);
+}
+
 //Fx07 - LD Vx, DT
 //Set Vx = delay timer value.
 static void instr_fx07(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
 {
     //The value of DT is placed into Vx.
     //printf("Fx07 - LD Vx, DT");
-    cpu->v[nib0] = cpu->dt;
+    cpu->v[nib0] = cpu_get_dt(cpu);
 }
 
 //Fx0A - LD Vx, K
@@ -416,7 +703,7 @@ static void instr_fx15(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //DT is set equal to the value of Vx.
     //printf("Fx15 - LD DT, Vx\n");
-    cpu->dt = cpu->v[nib0];
+    cpu->dt_end = timer_end(cpu, cpu->v[nib0]);
 }
 
 //Fx18 - LD ST, Vx
@@ -425,7 +712,7 @@ static void instr_fx18(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
 {
     //ST is set equal to the value of Vx.
     //printf("Fx18 - LD ST, Vx\n");
-    cpu->st = cpu->v[nib0];
+    cpu->st_end = timer_end(cpu, cpu->v[nib0]);
 }
 
 //Fx1E - ADD I, Vx
@@ -446,60 +733,200 @@ static void instr_fx29(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t ni
     cpu->i = DIGIT_SPRITES_ADDR + (cpu->v[nib0] * 5);
 }
 
+//Fx30 - LD HF, Vx
+//Set I = location of the 8x10 sprite for digit Vx (SCHIP).
+static void instr_fx30(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    cpu->i = BIG_DIGIT_SPRITES_ADDR + (cpu->v[nib0] & 0xf) * 10;
+}
+
 //Fx33 - LD B, Vx
 //Store BCD representation of Vx in memory locations I, I+1, and I+2.
 static void instr_fx33(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
 {
     //The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
     //printf("Fx33 - LD B, Vx\n");
-    cpu->mem[cpu->i] = (cpu->v[nib0] / 100) % 10;
-    cpu->mem[cpu->i+1] = (cpu->v[nib0] / 10) % 10;
-    cpu->mem[cpu->i+2] = cpu->v[nib0] % 10;
+    cpu->mem[cpu->i & MEM_MASK] = (cpu->v[nib0] / 100) % 10;
+    cpu->mem[(cpu->i+1) & MEM_MASK] = (cpu->v[nib0] / 10) % 10;
+    cpu->mem[(cpu->i+2) & MEM_MASK] = cpu->v[nib0] % 10;
+    mem_written(cpu, cpu->i, 3);
 }
 
 //Fx55 - LD [I], Vx
 //Store registers V0 through Vx in memory starting at location I.
-static void instr_fx55(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
-{
-    //The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
-    //printf("Fx55 - LD [I], Vx\n");
-    for(int i = 0; i <= nib0; i++)
-    {
-        cpu->mem[cpu->i+i] = cpu->v[i];
-    }
+//Quirk: I is left unchanged (keep), incremented by x+1 on the COSMAC VIP (inc) or by x on CHIP-48 (incx)
+//The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
+#define INSTR_FX55(variant, I_INC) \
+static void instr_fx55_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    for(int i = 0; i <= nib0; i++) \
+    { \
+        cpu->mem[(cpu->i+i) & MEM_MASK] = cpu->v[i]; \
+    } \
+    mem_written(cpu, cpu->i, nib0 + 1); \
+    cpu->i += (I_INC); \
 }
+INSTR_FX55(keep, 0)
+INSTR_FX55(inc, nib0 + 1)
+INSTR_FX55(incx, nib0)
 
 //Fx65 - LD Vx, [I]
 //Read registers V0 through Vx from memory starting at location I.
-static void instr_fx65(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+//Quirk: same I increments as Fx55
+//The interpreter reads values from memory starting at location I into registers V0 through Vx.
+#define INSTR_FX65(variant, I_INC) \
+static void instr_fx65_##variant(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    for(int i = 0; i <= nib0; i++) \
+    { \
+        cpu->v[i] = cpu->mem[(cpu->i+i) & MEM_MASK]; \
+    } \
+    cpu->i += (I_INC); \
+}
+INSTR_FX65(keep, 0)
+INSTR_FX65(inc, nib0 + 1)
+INSTR_FX65(incx, nib0)
+
+static void instr_dummy(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
 {
-    //The interpreter reads values from memory starting at location I into registers V0 through Vx.
-    //printf("Fx65 - LD Vx, [I]\n");
-    for(int i = 0; i <= nib0; i++)
-    {
-        cpu->v[i] = cpu->mem[cpu->i+i];
-    }
+    cpu_fail(cpu, CPU_BAD_OPCODE);
 }
 
-static void dummy_instr(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+// Handler tables, one per quirk profile. QUIRK_<quirk>(name) picks the
+// variant of instructions whose quirk isn't none, see instr.h.
+#define INSTR_HANDLER(name, mnemonic, quirk) QUIRK_##quirk(name),
+#define QUIRK_none(name) &instr_##name
+
+// the mix chippy always used
+#define QUIRK_logic(name) &instr_##name##_plain
+#define QUIRK_shr(name) &instr_##name##_vx
+#define QUIRK_shl(name) &instr_##name##_vy
+#define QUIRK_load(name) &instr_##name##_keep
+#define QUIRK_draw(name) &instr_##name##_wrap
+#define QUIRK_jump(name) &instr_##name##_v0
+static const instrp_t legacy_table[INSTR_COUNT] = { INSTR_LIST(INSTR_HANDLER) };
+#undef QUIRK_logic
+#undef QUIRK_shr
+#undef QUIRK_shl
+#undef QUIRK_load
+#undef QUIRK_draw
+#undef QUIRK_jump
+
+#define QUIRK_logic(name) &instr_##name##_vfreset
+#define QUIRK_shr(name) &instr_##name##_vy
+#define QUIRK_shl(name) &instr_##name##_vy
+#define QUIRK_load(name) &instr_##name##_inc
+#define QUIRK_draw(name) &instr_##name##_clip
+#define QUIRK_jump(name) &instr_##name##_v0
+static const instrp_t vip_table[INSTR_COUNT] = { INSTR_LIST(INSTR_HANDLER) };
+#undef QUIRK_logic
+#undef QUIRK_shr
+#undef QUIRK_shl
+#undef QUIRK_load
+#undef QUIRK_draw
+#undef QUIRK_jump
+
+#define QUIRK_logic(name) &instr_##name##_plain
+#define QUIRK_shr(name) &instr_##name##_vx
+#define QUIRK_shl(name) &instr_##name##_vx
+#define QUIRK_load(name) &instr_##name##_incx
+#define QUIRK_draw(name) &instr_##name##_clip
+#define QUIRK_jump(name) &instr_##name##_vx
+static const instrp_t chip48_table[INSTR_COUNT] = { INSTR_LIST(INSTR_HANDLER) };
+#undef QUIRK_logic
+#undef QUIRK_shr
+#undef QUIRK_shl
+#undef QUIRK_load
+#undef QUIRK_draw
+#undef QUIRK_jump
+
+#define QUIRK_logic(name) &instr_##name##_plain
+#define QUIRK_shr(name) &instr_##name##_vx
+#define QUIRK_shl(name) &instr_##name##_vx
+#define QUIRK_load(name) &instr_##name##_keep
+#define QUIRK_draw(name) &instr_##name##_clip
+#define QUIRK_jump(name) &instr_##name##_vx
+static const instrp_t schip_table[INSTR_COUNT] = { INSTR_LIST(INSTR_HANDLER) };
+#undef QUIRK_logic
+#undef QUIRK_shr
+#undef QUIRK_shl
+#undef QUIRK_load
+#undef QUIRK_draw
+#undef QUIRK_jump
+
+// Octo's defaults
+#define QUIRK_logic(name) &instr_##name##_plain
+#define QUIRK_shr(name) &instr_##name##_vy
+#define QUIRK_shl(name) &instr_##name##_vy
+#define QUIRK_load(name) &instr_##name##_inc
+#define QUIRK_draw(name) &instr_##name##_wrap
+#define QUIRK_jump(name) &instr_##name##_v0
+static const instrp_t modern_table[INSTR_COUNT] = { INSTR_LIST(INSTR_HANDLER) };
+#undef QUIRK_logic
+#undef QUIRK_shr
+#undef QUIRK_shl
+#undef QUIRK_load
+#undef QUIRK_draw
+#undef QUIRK_jump
+
+#undef QUIRK_none
+#undef INSTR_HANDLER
+
+static const instrp_t *const quirk_tables[QUIRKS_COUNT] =
+{
+    legacy_table,
+    vip_table,
+    chip48_table,
+    schip_table,
+    modern_table
+};
+
+static const char *const instr_mnemonics[INSTR_COUNT] =
 {
-    printf("Instruction not implemented!\n");
-    exit(0);
+#define INSTR_MNEMONIC(name, mnemonic, quirk) mnemonic,
+    INSTR_LIST(INSTR_MNEMONIC)
+#undef INSTR_MNEMONIC
+};
+
+// instrumented handlers, the checks may stop the instruction
+#define INSTR_DEBUG(name, mnemonic, quirk) \
+static void debug_##name(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2) \
+{ \
+    if(debug_check(cpu->debug, cpu, INSTR_##name, nib0, nib1, nib2)) return; \
+    (*cpu->debug->table[INSTR_##name])(cpu, nib0, nib1, nib2); \
 }
+INSTR_LIST(INSTR_DEBUG)
+#undef INSTR_DEBUG
 
-typedef void (*instrp_t)(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib3);
+static const instrp_t debug_table[INSTR_COUNT] =
+{
+#define INSTR_HANDLER(name, mnemonic, quirk) &debug_##name,
+    INSTR_LIST(INSTR_HANDLER)
+#undef INSTR_HANDLER
+};
+
+const instrp_t *cpu_debug_table(void)
+{
+    return debug_table;
+}
+
+const char *instr_mnemonic(int id)
+{
+    if(id < 0 || id >= INSTR_COUNT) return "????";
+    return instr_mnemonics[id];
+}
 
 static uint16_t fetch(struct chip8 *cpu)
 {
     //printf("Fetching @PC=0x%04X\n", cpu->pc);
     //assert(cpu->pc % 2 == 0);
-    uint16_t result = bytes2opcode(cpu->mem[cpu->pc], cpu->mem[cpu->pc+1]);
+    uint16_t result = bytes2opcode(cpu->mem[cpu->pc & MEM_MASK], cpu->mem[(cpu->pc+1) & MEM_MASK]);
     cpu->pc += 2;
     return result;
 }
 
 // TODO use binary AND for filtered comparison
-static instrp_t decode(uint16_t opcode)
+static uint8_t decode(uint16_t opcode)
 {
     //printf("Decoding opcode=0x%04X\n", opcode);
     uint8_t nib0 = opcode2nib(opcode, 0);
@@ -510,142 +937,501 @@ static instrp_t decode(uint16_t opcode)
     {
         case 0x0:
             if(nib1 == 0x0 && nib2 == 0xe && nib3 == 0x0)
-                return &instr_00e0;
+                return INSTR_00e0;
             else if(nib1 == 0x0 && nib2 == 0xe && nib3 == 0xe)
-                return &instr_00ee;
+                return INSTR_00ee;
+            else if(nib1 == 0x0 && nib2 == 0xc)
+                return INSTR_00cn;
+            else if(nib1 == 0x0 && nib2 == 0xd)
+                return INSTR_00dn;
+            else if(nib1 == 0x0 && nib2 == 0xf && nib3 == 0xb)
+                return INSTR_00fb;
+            else if(nib1 == 0x0 && nib2 == 0xf && nib3 == 0xc)
+                return INSTR_00fc;
+            else if(nib1 == 0x0 && nib2 == 0xf && nib3 == 0xd)
+                return INSTR_00fd;
+            else if(nib1 == 0x0 && nib2 == 0xf && nib3 == 0xe)
+                return INSTR_00fe;
+            else if(nib1 == 0x0 && nib2 == 0xf && nib3 == 0xf)
+                return INSTR_00ff;
             else
-                return &instr_0nnn;
+                return INSTR_0nnn;
         case 0x1:
-            return &instr_1nnn;
+            return INSTR_1nnn;
         case 0x2:
-            return &instr_2nnn;
+            return INSTR_2nnn;
         case 0x3:
-            return &instr_3xkk;
+            return INSTR_3xkk;
         case 0x4:
-            return &instr_4xkk;
+            return INSTR_4xkk;
         case 0x5:
             if(nib3 == 0x0)
-                return &instr_5xy0;
+                return INSTR_5xy0;
             break;
         case 0x6:
-            return &instr_6xkk;
+            return INSTR_6xkk;
         case 0x7:
-            return &instr_7xkk;
+            return INSTR_7xkk;
         case 0x8:
             if(nib3 == 0x0)
-                return &instr_8xy0;
+                return INSTR_8xy0;
             else if(nib3 == 0x1)
-                return &instr_8xy1;
+                return INSTR_8xy1;
             else if(nib3 == 0x2)
-                return &instr_8xy2;
+                return INSTR_8xy2;
             else if(nib3 == 0x3)
-                return &instr_8xy3;
+                return INSTR_8xy3;
             else if(nib3 == 0x4)
-                return &instr_8xy4;
+                return INSTR_8xy4;
             else if(nib3 == 0x5)
-                return &instr_8xy5;
+                return INSTR_8xy5;
             else if(nib3 == 0x6)
-                return &instr_8xy6;
+                return INSTR_8xy6;
             else if(nib3 == 0x7)
-                return &instr_8xy7;
+                return INSTR_8xy7;
             else if(nib3 == 0xe)
-                return &instr_8xye;
+                return INSTR_8xye;
             break;
         case 0x9:
             if(nib3 == 0x0)
-                return &instr_9xy0;
+                return INSTR_9xy0;
             break;
         case 0xa:
-            return &instr_annn;
+            return INSTR_annn;
         case 0xb:
-            return &instr_bnnn;
+            return INSTR_bnnn;
         case 0xc:
-            return &instr_cxkk;
+            return INSTR_cxkk;
         case 0xd:
-            return &instr_dxyn;
+            return INSTR_dxyn;
         case 0xe:
             if(nib2 == 0x9 && nib3 == 0xe)
-                return &instr_ex9e;
+                return INSTR_ex9e;
             else if(nib2 == 0xa && nib3 == 0x1)
-                return &instr_exa1;
+                return INSTR_exa1;
             break;
         case 0xf:
-            if(nib2 == 0x0 && nib3 == 0x7)
-                return &instr_fx07;
+            if(nib2 == 0x0 && nib3 == 0x1)
+                return INSTR_fn01;
+            else if(nib2 == 0x0 && nib3 == 0x7)
+                return INSTR_fx07;
             else if (nib2 == 0x0 && nib3 == 0xa)
-                return &instr_fx0a;
+                return INSTR_fx0a;
             else if (nib2 == 0x1 && nib3 == 0x5)
-                return &instr_fx15;
+                return INSTR_fx15;
             else if (nib2 == 0x1 && nib3 == 0x8)
-                return &instr_fx18;
+                return INSTR_fx18;
             else if (nib2 == 0x1 && nib3 == 0xe)
-                return &instr_fx1e;
+                return INSTR_fx1e;
             else if (nib2 == 0x2 && nib3 == 0x9)
-                return &instr_fx29;
+                return INSTR_fx29;
+            else if (nib2 == 0x3 && nib3 == 0x0)
+                return INSTR_fx30;
             else if (nib2 == 0x3 && nib3 == 0x3)
-                return &instr_fx33;
+                return INSTR_fx33;
             else if (nib2 == 0x5 && nib3 == 0x5)
-                return &instr_fx55;
+                return INSTR_fx55;
             else if (nib2 == 0x6 && nib3 == 0x5)
-                return &instr_fx65;
+                return INSTR_fx65;
             break;
         default:
-            return &dummy_instr;
+            return INSTR_dummy;
     }
-    return &dummy_instr;
+    return INSTR_dummy;
 }
 
-static void execute(struct chip8 *cpu, instrp_t instr, uint16_t opcode)
+static void execute(struct chip8 *cpu, uint8_t id, uint16_t opcode)
 {
     uint8_t nib1 = opcode2nib(opcode, 1);
     uint8_t nib2 = opcode2nib(opcode, 2);
     uint8_t nib3 = opcode2nib(opcode, 3);
-    (*instr)(cpu, nib1, nib2, nib3);
+    (*cpu->instr_table[id])(cpu, nib1, nib2, nib3);
 }
 
+static void tick(struct chip8 *cpu);
+
 void cpu_cycle(struct chip8 *cpu)
 {
-    if(cpu->wait_key) return;
-    uint16_t opcode = fetch(cpu);
-    instrp_t instr = decode(opcode);
-    execute(cpu, instr, opcode);
+    if(cpu->paused || cpu->status) return;
+    if(!cpu->wait_key)
+    {
+        uint16_t pc = cpu->pc;
+        uint16_t opcode = fetch(cpu);
+        uint8_t id = decode(opcode);
+        PROFILE_INSTR(cpu, id, pc);
+        execute(cpu, id, opcode);
+        // a watch stopped before the instruction, it runs on resume
+        if(cpu->paused)
+            return;
+        if(cpu->trace && !cpu->status)
+            trace_instr(cpu->trace, cpu, pc, opcode);
+    }
+    if(++cpu->cycles == cpu->next_tick)
+        tick(cpu);
+}
+
+// Hashes 8 bytes at a time, only used to compare states
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *p, size_t len)
+{
+    for(size_t k=0; k<len; k+=8)
+    {
+        uint64_t w = 0;
+        memcpy(&w, p + k, len - k < 8 ? len - k : 8);
+        hash = (hash ^ w) * 0x100000001b3ULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+// Hash of one word at index, the words are summed up so changing one
+// only changes its term. Zero words, most of mem and disp, add nothing.
+static uint64_t hash_word(uint64_t w, uint32_t index)
+{
+    if(w == 0)
+        return 0;
+    uint64_t hash = w ^ (index + 1) * 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ hash >> 33) * 0xff51afd7ed558ccdULL;
+    hash = (hash ^ hash >> 33) * 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ hash >> 33;
+}
+
+static void hash_mem(struct chip8 *cpu)
+{
+    uint32_t lo = cpu->dirty_lo, hi = cpu->dirty_hi;
+    if(!cpu->mem_hashed)
+    {
+        lo = 0;
+        hi = CPU_MEM_SIZE / 8 - 1;
+        memset(cpu->block_hashes, 0, sizeof(cpu->block_hashes));
+        cpu->mem_hash = 0;
+        cpu->mem_hashed = 1;
+    }
+    for(uint32_t b=lo; b<=hi; b++)
+    {
+        uint64_t w;
+        memcpy(&w, cpu->mem + 8 * b, 8);
+        cpu->mem_hash -= cpu->block_hashes[b];
+        cpu->block_hashes[b] = hash_word(w, b);
+        cpu->mem_hash += cpu->block_hashes[b];
+    }
+    cpu->dirty_lo = CPU_MEM_SIZE / 8;
+    cpu->dirty_hi = 0;
+}
+
+static void hash_disp(struct chip8 *cpu)
+{
+    if(!cpu->disp_hashed)
+    {
+        memset(cpu->row_hashes, 0, sizeof(cpu->row_hashes));
+        cpu->disp_hash = 0;
+        for(int p=0; p<DISPLAY_PLANES; p++)
+            cpu->dirty_rows[p] = ~0ULL;
+        cpu->disp_hashed = 1;
+    }
+    for(int p=0; p<DISPLAY_PLANES; p++)
+    {
+        for(int y=0; cpu->dirty_rows[p] != 0; y++)
+        {
+            if(!(cpu->dirty_rows[p] & 1ULL << y))
+                continue;
+            cpu->dirty_rows[p] &= ~(1ULL << y);
+            const uint64_t *row = cpu->disp.rows[p][y];
+            uint32_t index = (uint32_t)(p * DISPLAY_HEIGHT + y) * 2;
+            cpu->disp_hash -= cpu->row_hashes[p][y];
+            cpu->row_hashes[p][y] = hash_word(row[0], index) + hash_word(row[1], index + 1);
+            cpu->disp_hash += cpu->row_hashes[p][y];
+        }
+    }
+}
+
+static uint64_t state_hash(struct chip8 *cpu)
+{
+    uint8_t regs[] =
+    {
+        (uint8_t)cpu->i, (uint8_t)(cpu->i >> 8),
+        (uint8_t)cpu->pc, (uint8_t)(cpu->pc >> 8),
+        (uint8_t)cpu->keys, (uint8_t)(cpu->keys >> 8),
+        (uint8_t)cpu->rng, (uint8_t)(cpu->rng >> 8),
+        (uint8_t)(cpu->rng >> 16), (uint8_t)(cpu->rng >> 24),
+        cpu_get_dt(cpu), cpu_get_st(cpu), cpu->sp,
+        cpu->disp.hires, cpu->planes
+    };
+    hash_mem(cpu);
+    hash_disp(cpu);
+    uint64_t hash = cpu->mem_hash;
+    hash = hash_bytes(hash, cpu->v, sizeof(cpu->v));
+    hash = hash_bytes(hash, (const uint8_t *)cpu->stack, sizeof(cpu->stack));
+    hash = hash_bytes(hash, (const uint8_t *)&cpu->disp_hash, sizeof(cpu->disp_hash));
+    return hash_bytes(hash, regs, sizeof(regs));
+}
+
+// Halts the cpu if its state repeats, from there it loops forever
+static void check_state_repeat(struct chip8 *cpu)
+{
+    uint64_t hash = state_hash(cpu);
+    for(int k=0; k<cpu->hash_count; k++)
+    {
+        if(cpu->hashes[k] == hash)
+        {
+            cpu->status = CPU_HALTED;
+            return;
+        }
+    }
+    cpu->hashes[cpu->hash_pos] = hash;
+    cpu->hash_pos = (cpu->hash_pos + 1) % CPU_HALT_HASHES;
+    if(cpu->hash_count < CPU_HALT_HASHES)
+        cpu->hash_count++;
+}
+
+// Superinstructions: sequences which are common in ROMs run as one
+// handler in cpu_run, saving the fetch, decode and dispatch of each but
+// the first instruction. Which sequence starts at an address is found
+// when it's first executed and kept in cpu->fuse until the memory is
+// written.
+enum fuse_kind
+{
+    FUSE_UNKNOWN, // not looked at yet
+    FUSE_NONE,
+    FUSE_ANNN_DXYN, // draw a sprite
+    FUSE_TIMER_WAIT, // Fx07, 3xkk with the same x, 1nnn back to the Fx07
+    FUSE_6XKK_6XKK,
+    FUSE_7XKK_3XKK // counter loop
+};
+
+// instructions per sequence
+static const uint8_t fuse_length[] = { 1, 1, 2, 3, 2, 2 };
+
+static uint16_t opcode_at(struct chip8 *cpu, uint16_t addr)
+{
+    return bytes2opcode(cpu->mem[addr & MEM_MASK], cpu->mem[(addr+1) & MEM_MASK]);
+}
+
+static uint8_t fuse_find(struct chip8 *cpu, uint16_t pc)
+{
+    // every address is looked at once, which is most of the work in short
+    // runs (the fuzz target), so match the opcode patterns directly: the
+    // groups 1, 3, 6, 7, A and D decode to one instruction each
+    uint16_t op0 = opcode_at(cpu, pc);
+    uint16_t op1 = opcode_at(cpu, pc + 2);
+
+    switch(op0 >> 12)
+    {
+        case 0xf:
+        {
+            uint16_t op2 = opcode_at(cpu, pc + 4);
+            if((op0 & 0xff) == 0x07 && (op1 & 0xf000) == 0x3000 && (op0 & 0x0f00) == (op1 & 0x0f00)
+                && op2 == (0x1000 | pc))
+                return FUSE_TIMER_WAIT;
+            break;
+        }
+        case 0xa:
+            if((op1 & 0xf000) == 0xd000)
+                return FUSE_ANNN_DXYN;
+            break;
+        case 0x6:
+            if((op1 & 0xf000) == 0x6000)
+                return FUSE_6XKK_6XKK;
+            break;
+        case 0x7:
+            if((op1 & 0xf000) == 0x3000)
+                return FUSE_7XKK_3XKK;
+            break;
+    }
+    return FUSE_NONE;
+}
+
+// Runs the sequence at pc, at most max instructions, returns how many ran.
+// The caller adds them to the cycles.
+static uint64_t fuse_run(struct chip8 *cpu, uint8_t kind, uint64_t max)
+{
+    uint16_t pc = cpu->pc;
+    uint16_t op0 = opcode_at(cpu, pc);
+    uint16_t op1 = opcode_at(cpu, pc + 2);
+    uint8_t x0 = op0 >> 8 & 0xf;
+    uint8_t x1 = op1 >> 8 & 0xf;
+
+    switch(kind)
+    {
+        case FUSE_ANNN_DXYN:
+            cpu->i = op0 & 0xfff;
+            cpu->pc = pc + 4;
+            (*cpu->instr_table[INSTR_dxyn])(cpu, x1, op1 >> 4 & 0xf, op1 & 0xf);
+            return 2;
+
+        case FUSE_TIMER_WAIT:
+        {
+            uint8_t dt = cpu_get_dt(cpu);
+            cpu->v[x0] = dt;
+            if(dt == (op1 & 0xff))
+            {
+                cpu->pc = pc + 6;
+                return 2;
+            }
+            // max doesn't reach the next tick, DT stays the same and every
+            // round ends back at pc
+            return max - max % 3;
+        }
+
+        case FUSE_6XKK_6XKK:
+            cpu->v[x0] = op0 & 0xff;
+            cpu->v[x1] = op1 & 0xff;
+            cpu->pc = pc + 4;
+            return 2;
+
+        case FUSE_7XKK_3XKK:
+            cpu->v[x0] += op0 & 0xff;
+            cpu->pc = pc + (cpu->v[x1] == (op1 & 0xff) ? 6 : 4);
+            return 2;
+    }
+    return 0;
 }
 
-void cpu_tick60hz(struct chip8 *cpu)
+// Executes instructions until cycles reaches end, which must not be past
+// the next tick, returns the number executed
+static uint64_t run_until(struct chip8 *cpu, uint64_t end)
 {
-    if(cpu->dt > 0) cpu->dt--;
-    if(cpu->st > 0) cpu->st--;
+    uint64_t done = 0;
+
+    while(cpu->cycles < end && !(cpu->wait_key || cpu->paused || cpu->status))
+    {
+        uint16_t pc = cpu->pc & MEM_MASK;
+        uint8_t kind = cpu->fuse[pc];
+        if(kind == FUSE_UNKNOWN)
+            kind = cpu->fuse[pc] = fuse_find(cpu, pc);
+        if(kind != FUSE_NONE && end - cpu->cycles >= fuse_length[kind] && pc == cpu->pc)
+        {
+            uint64_t ran = fuse_run(cpu, kind, end - cpu->cycles);
+            cpu->cycles += ran;
+            done += ran;
+            continue;
+        }
+        uint16_t opcode = fetch(cpu);
+        execute(cpu, decode(opcode), opcode);
+        cpu->cycles++;
+        done++;
+    }
+    return done;
+}
+
+uint64_t cpu_run(struct chip8 *cpu, uint64_t n)
+{
+    uint64_t done = 0;
+    uint64_t end = cpu->cycles + n;
+
+    // hooks see every instruction
+    int hooked = cpu->trace != NULL || cpu->debug != NULL;
+#ifdef CHIPPY_PROFILE
+    hooked |= cpu->profile != NULL;
+#endif
+    if(hooked)
+    {
+        while(cpu->cycles < end && !(cpu->paused || cpu->status))
+        {
+            int ran = !cpu->wait_key;
+            cpu_cycle(cpu);
+            done += ran && !cpu->paused;
+        }
+        return done;
+    }
+
+    // the timers only change at ticks, so run up to each tick at a time
+    while(cpu->cycles < end && !(cpu->paused || cpu->status))
+    {
+        uint64_t stop = end < cpu->next_tick ? end : cpu->next_tick;
+        if(cpu->wait_key)
+            cpu->cycles = stop;
+        else
+            done += run_until(cpu, stop);
+        if(cpu->cycles == cpu->next_tick)
+            tick(cpu);
+    }
+    return done;
+}
+
+void cpu_idle(struct chip8 *cpu, uint64_t n)
+{
+    cpu->cycles += n;
+    if(cpu->cycles >= cpu->next_tick)
+        cpu->next_tick += ((cpu->cycles - cpu->next_tick) / cpu->tick_cycles + 1) * cpu->tick_cycles;
+}
+
+void cpu_set_tick_cycles(struct chip8 *cpu, uint32_t cycles)
+{
+    cpu->tick_cycles = cycles > 0 ? cycles : 1;
+    cpu->next_tick = cpu->cycles + cpu->tick_cycles;
+}
+
+// The timers count down on their own, only the hang check runs per tick
+static void tick(struct chip8 *cpu)
+{
+    cpu->next_tick += cpu->tick_cycles;
+    // waiting for a key isn't a hang
+    if((cpu->halt_check & CPU_HALT_HASH) && !cpu->wait_key && !cpu->paused && !cpu->status)
+        check_state_repeat(cpu);
 }
 
 void cpu_reset(struct chip8 *cpu)
 {
-    memset(cpu->v, 0, 0xf);
-    memset(cpu->stack, 0, 0xf * sizeof(uint16_t));
-    memset(cpu->disp, 0, 8*32);
+    memset(cpu->v, 0, sizeof(cpu->v));
+    memset(cpu->stack, 0, sizeof(cpu->stack));
+    memset(&cpu->disp, 0, sizeof(cpu->disp));
     memcpy(cpu->mem + DIGIT_SPRITES_ADDR, &digit_sprites, sizeof(digit_sprites));
+    memcpy(cpu->mem + BIG_DIGIT_SPRITES_ADDR, &big_digit_sprites, sizeof(big_digit_sprites));
+    memset(cpu->fuse, 0, sizeof(cpu->fuse));
+    cpu->planes = 1;
     cpu->i = 0;
-    cpu->dt = 0;
-    cpu->st = 0;
     cpu->sp = 0;
+    cpu->cycles = 0;
+    cpu->next_tick = cpu->tick_cycles;
+    cpu->dt_end = 0;
+    cpu->st_end = 0;
     cpu->pc = BASE_ADDR;
     cpu->keys = 0;
     cpu->wait_key = 0;
     cpu->key_vx = 0;
+    cpu->paused = 0;
+    cpu->status = CPU_OK;
+    cpu->hash_pos = 0;
+    cpu->hash_count = 0;
+    cpu->mem_hashed = 0;
+    cpu->disp_hashed = 0;
+    cpu->rng = cpu->seed;
 }
 
 void cpu_init(struct chip8 *cpu)
 {
-    memset(cpu->mem, 0, 0xfff);
+    memset(cpu->mem, 0, sizeof(cpu->mem));
+    cpu->tick_cycles = CPU_TICK_CYCLES;
+    cpu_seed(cpu, 1234);
     cpu_reset(cpu);
-    srand(1234);
+    cpu->instr_table = legacy_table;
+    cpu->quirks = QUIRKS_LEGACY;
+    cpu->halt_check = 0;
+    cpu->trace = NULL;
+    cpu->debug = NULL;
+#ifdef CHIPPY_PROFILE
+    cpu->profile = NULL;
+#endif
 }
 
-void cpu_load_rom(struct chip8 *cpu, const char *path)
+void cpu_seed(struct chip8 *cpu, uint32_t seed)
+{
+    cpu->seed = seed != 0 ? seed : 1234;
+    cpu->rng = cpu->seed;
+}
+
+int cpu_load_rom(struct chip8 *cpu, const char *path)
 {
     FILE *fs = fopen(path, "rb");
+    if(fs == NULL)
+        return -1;
     fseek(fs, 0, SEEK_END);
     size_t fsize = ftell(fs);
-    assert(fsize <= 0xfff-BASE_ADDR);
+    if(fsize > CPU_MEM_SIZE - BASE_ADDR)
+    {
+        fclose(fs);
+        return -1;
+    }
     rewind(fs);
     size_t read = 0;
     while(read < fsize)
@@ -653,20 +1439,40 @@ void cpu_load_rom(struct chip8 *cpu, const char *path)
         read += fread(cpu->mem + BASE_ADDR + read, 1, fsize, fs);
     }
     fclose(fs);
+    memset(cpu->fuse, 0, sizeof(cpu->fuse));
+    cpu->mem_hashed = 0;
+    return (int)fsize;
 }
 
-int cpu_get_pixel(struct chip8 *cpu, int x, int y)
+const char *cpu_status_name(enum cpu_status status)
 {
-    x = x % 64;
-    y = y % 32;
-
-    int target_byte = (y * 8) + (x / 8);
+    switch(status)
+    {
+        case CPU_OK: return "ok";
+        case CPU_STACK_OVERFLOW: return "stack overflow";
+        case CPU_STACK_UNDERFLOW: return "stack underflow";
+        case CPU_HALTED: return "halted";
+        case CPU_BAD_OPCODE: return "bad opcode";
+    }
+    return "?";
+}
 
-    uint8_t value_mask = (uint8_t) 128 >> (x % 8);
+void cpu_set_quirks(struct chip8 *cpu, enum quirks quirks)
+{
+    cpu->quirks = quirks;
+    // the debugger calls the table it replaced
+    if(cpu->instr_table == debug_table)
+        cpu->debug->table = quirk_tables[quirks];
+    else
+        cpu->instr_table = quirk_tables[quirks];
+}
 
-    int result = cpu->disp[target_byte] & value_mask;
+int cpu_get_pixel(struct chip8 *cpu, int x, int y)
+{
+    x = x % disp_width(cpu);
+    y = y % disp_height(cpu);
 
-    return result;
+    return (cpu->disp.rows[0][y][x / 64] >> (63 - x % 64)) & 1;
 }
 
 void cpu_set_key_state(struct chip8 *cpu, uint8_t key, uint8_t state)
@@ -681,7 +1487,7 @@ void cpu_set_key_state(struct chip8 *cpu, uint8_t key, uint8_t state)
             cpu->v[cpu->key_vx] = key;
             cpu->wait_key = 0;
         }
-        printf("key pressed = %i, keys = %i\n", key, cpu->keys);
+        //printf("key pressed = %i, keys = %i\n", key, cpu->keys);
         //exit(0);
     }
     else
@@ -691,6 +1497,32 @@ void cpu_set_key_state(struct chip8 *cpu, uint8_t key, uint8_t state)
     }
 }
 
+void cpu_set_keys(struct chip8 *cpu, uint16_t keys)
+{
+    uint16_t old_keys = cpu->keys;
+
+    for(uint8_t k=0; k<0x10; k++)
+    {
+        uint8_t down = keys >> k & 1;
+        if(down != (old_keys >> k & 1) || (down && cpu->wait_key))
+            cpu_set_key_state(cpu, k, down);
+    }
+}
+
 void cpu_dump_state(struct chip8 *cpu)
 {
+    uint16_t opcode = bytes2opcode(cpu->mem[cpu->pc & MEM_MASK], cpu->mem[(cpu->pc + 1) & MEM_MASK]);
+
+    printf("PC=%03X  %04X  %s\n", cpu->pc, opcode, instr_mnemonic(decode(opcode)));
+    for(int r=0; r<16; r++)
+        printf("V%X=%02X%s", r, cpu->v[r], r == 7 || r == 15 ? "\n" : " ");
+    printf("I=%03X DT=%02X ST=%02X SP=%X keys=%04X%s\n",
+        cpu->i, cpu_get_dt(cpu), cpu_get_st(cpu), cpu->sp, cpu->keys,
+        cpu->wait_key ? " (waiting for key)" : "");
+    if(cpu->status)
+        printf("stopped: %s\n", cpu_status_name(cpu->status));
+    printf("stack:");
+    for(int s=0; s<cpu->sp; s++)
+        printf(" %03X", cpu->stack[s]);
+    printf("\n");
 }
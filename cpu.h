@@ -2,38 +2,163 @@
 #define CHIPPY_CPU_H
 
 #include <stdint.h>
+#include "display.h"
+
+#define CPU_ROM_ADDR 0x200 // ROMs are loaded here
+#define CPU_MEM_SIZE 4096 // must be a power of two
+#define CPU_STACK_SIZE 16
+#define CPU_HALT_HASHES 16 // state hashes compared by CPU_HALT_HASH
+#define CPU_TICK_CYCLES (500 / 60) // default instructions per 60 Hz tick
+
+struct chip8;
+struct chip8_profile;
+struct chip8_trace;
+struct chip8_debug;
+
+// Interpreter behaviours which differ between CHIP-8 implementations
+enum quirks
+{
+    QUIRKS_LEGACY, // chippy's original mix
+    QUIRKS_VIP, // COSMAC VIP
+    QUIRKS_CHIP48,
+    QUIRKS_SCHIP,
+    QUIRKS_MODERN, // Octo style CHIP-8
+    QUIRKS_COUNT
+};
+
+// Why the cpu stopped, it doesn't execute anything until reset
+enum cpu_status
+{
+    CPU_OK,
+    CPU_STACK_OVERFLOW, // CALL with a full stack
+    CPU_STACK_UNDERFLOW, // RET with an empty stack
+    CPU_HALTED, // can't make progress anymore, see enum cpu_halt_check
+    CPU_BAD_OPCODE // instruction not implemented
+};
+
+// Hang detection, flags in halt_check. Both assume no further key input.
+enum cpu_halt_check
+{
+    CPU_HALT_JUMP = 1, // 1nnn jumping to itself with both timers at zero
+    CPU_HALT_HASH = 2 // the full state at a timer tick repeats one of the
+                      // last CPU_HALT_HASHES ticks, costs a hash per tick
+};
+
+typedef void (*instrp_t)(struct chip8 *cpu, uint8_t nib0, uint8_t nib1, uint8_t nib2);
 
 // TODO use union to overlap registers etc. with  memory
 struct chip8
 {
-    uint8_t mem[4096]; // memory
+    uint8_t mem[CPU_MEM_SIZE]; // memory
     uint8_t v[16]; // general purpose registers
     uint16_t i; // address register
-    uint8_t dt; // delay timer
-    uint8_t st; // sound timer
     uint8_t sp; // stack pointer
-    uint16_t stack[16]; // stack
+    uint16_t stack[CPU_STACK_SIZE]; // stack
     uint16_t pc; // program counter
     uint16_t keys; // keypad keys
-    uint8_t disp[8*32]; // 64x32 bit
+    struct chip8_display disp;
+    uint8_t planes; // XO-CHIP planes drawn, cleared and scrolled (Fn01)
     uint8_t wait_key; // waiting for key event
     uint8_t key_vx; // v index to store pressed key
+    uint8_t paused; // stopped by the debugger
+    uint8_t quirks; // enum quirks of instr_table
+    uint8_t status; // enum cpu_status, stopped if not CPU_OK
+    uint8_t halt_check; // enum cpu_halt_check flags, kept by cpu_reset
+    uint8_t hash_pos; // next slot in hashes
+    uint8_t hash_count; // valid slots in hashes
+    uint32_t rng; // xorshift32 state of Cxkk, never 0
+    uint32_t seed; // rng after cpu_reset, kept by cpu_reset
+    uint64_t hashes[CPU_HALT_HASHES]; // states of the last ticks
+    // The halt check hashes mem in blocks of 8 bytes and disp.rows by
+    // row, only the ones changed since the last tick are hashed again
+    uint64_t mem_hash; // sum of block_hashes
+    uint64_t block_hashes[CPU_MEM_SIZE / 8];
+    uint16_t dirty_lo, dirty_hi; // blocks written, none if lo > hi
+    uint8_t mem_hashed; // block_hashes are valid, else all are hashed again
+    uint64_t disp_hash; // sum of row_hashes
+    uint64_t row_hashes[DISPLAY_PLANES][DISPLAY_HEIGHT];
+    uint64_t dirty_rows[DISPLAY_PLANES]; // rows drawn, bit y for row y
+    uint8_t disp_hashed; // row_hashes are valid, else all are hashed again
+    // Guest time counts in cycles, one per instruction or per instruction
+    // slot spent waiting for a key. The timers are the cycles at which
+    // they reach zero and are only computed when read, see cpu_get_dt.
+    uint64_t cycles; // since reset
+    uint64_t next_tick; // cycles at the next 60 Hz timer tick
+    uint64_t dt_end; // delay timer deadline
+    uint64_t st_end; // sound timer deadline
+    uint32_t tick_cycles; // cycles per tick, kept by cpu_reset
+    uint8_t fuse[CPU_MEM_SIZE]; // fused sequence starting at each address,
+                                // 0 if not looked at yet, see cpu_run
+    const instrp_t *instr_table; // dispatch table, indexed by instr_id
+    struct chip8_debug *debug; // watches, NULL if not debugging
+    struct chip8_trace *trace; // execution trace, NULL if not tracing
+#ifdef CHIPPY_PROFILE
+    struct chip8_profile *profile; // counters, NULL if not profiling
+#endif
 };
 
+// Executes one instruction, or lets one cycle pass while waiting for a key
 void cpu_cycle(struct chip8 *cpu);
 
-void cpu_tick60hz(struct chip8 *cpu);
+// Runs n cycles like n cpu_cycle calls, common sequences run as one fused
+// handler. Stops early if paused or stopped, returns the number of
+// instructions executed.
+uint64_t cpu_run(struct chip8 *cpu, uint64_t n);
+
+// Lets n cycles pass without executing anything, e.g. for a cpu that is
+// known to just wait
+void cpu_idle(struct chip8 *cpu, uint64_t n);
+
+// Timer values at the current cycle, inline so tools reading a cpu
+// (chippy-trace, chippy-shm) don't need cpu.c
+static inline uint8_t cpu_timer_value(const struct chip8 *cpu, uint64_t end)
+{
+    if(end <= cpu->cycles)
+        return 0;
+    return (uint8_t)((end - cpu->cycles + cpu->tick_cycles - 1) / cpu->tick_cycles);
+}
+
+static inline uint8_t cpu_get_dt(const struct chip8 *cpu)
+{
+    return cpu_timer_value(cpu, cpu->dt_end);
+}
+
+static inline uint8_t cpu_get_st(const struct chip8 *cpu)
+{
+    return cpu_timer_value(cpu, cpu->st_end);
+}
+
+// Sets the cycles per 60 Hz timer tick, the next tick is that far away
+void cpu_set_tick_cycles(struct chip8 *cpu, uint32_t cycles);
 
 void cpu_reset(struct chip8 *cpu);
 
 void cpu_init(struct chip8 *cpu);
 
-void cpu_load_rom(struct chip8 *cpu, const char *path);
+// Seeds the random numbers of Cxkk, cpu_init seeds with 1234, cpu_reset
+// starts over from the seed
+void cpu_seed(struct chip8 *cpu, uint32_t seed);
+
+// Returns the size of the ROM or -1 if it can't be read
+int cpu_load_rom(struct chip8 *cpu, const char *path);
+
+const char *cpu_status_name(enum cpu_status status);
 
+// Switches to the handler table of the quirk profile
+void cpu_set_quirks(struct chip8 *cpu, enum quirks quirks);
+
+// Pixel of plane 0 in the current mode
 int cpu_get_pixel(struct chip8 *cpu, int x, int y);
 
 void cpu_set_key_state(struct chip8 *cpu, uint8_t key, uint8_t state);
 
+// Sets all keys from a mask, like calling cpu_set_key_state for changed
+// keys, held keys are passed again while the cpu waits for one
+void cpu_set_keys(struct chip8 *cpu, uint16_t keys);
+
 void cpu_dump_state(struct chip8 *cpu);
 
+// Dispatch table which runs debug_check before every instruction
+const instrp_t *cpu_debug_table(void);
+
 #endif
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <string.h>
+#include "debug.h"
+#include "instr.h"
+
+void debug_init(struct chip8_debug *dbg)
+{
+    memset(dbg, 0, sizeof(*dbg));
+    dbg->hit = -1;
+}
+
+static int parse_range(const char *s, uint16_t *lo, uint16_t *hi)
+{
+    unsigned int a, b;
+    int n = sscanf(s, "%x-%x", &a, &b);
+    if(n < 1 || a > 0xfff)
+        return 1;
+    if(n == 1)
+        b = a;
+    if(b < a || b > 0xfff)
+        return 1;
+    *lo = (uint16_t)a;
+    *hi = (uint16_t)b;
+    return 0;
+}
+
+int debug_add(struct chip8_debug *dbg, const char *spec)
+{
+    char kind[8];
+    char rest[32];
+    char op[4];
+    unsigned int value;
+    struct debug_watch w;
+
+    if(dbg->count == DEBUG_MAX_WATCHES)
+        return 1;
+    if(sscanf(spec, "%7s %31[^\n]", kind, rest) != 2)
+        return 1;
+    memset(&w, 0, sizeof(w));
+
+    if(strcmp(kind, "pc") == 0)
+    {
+        w.type = WATCH_PC;
+        if(parse_range(rest, &w.lo, &w.hi) != 0)
+            return 1;
+    }
+    else if(strcmp(kind, "r") == 0 || strcmp(kind, "w") == 0 || strcmp(kind, "rw") == 0)
+    {
+        w.type = kind[1] ? WATCH_ACCESS : kind[0] == 'r' ? WATCH_READ : WATCH_WRITE;
+        if(parse_range(rest, &w.lo, &w.hi) != 0)
+            return 1;
+    }
+    else if((kind[0] == 'v' || kind[0] == 'i') && sscanf(rest, "%3s %x", op, &value) == 2)
+    {
+        unsigned int reg = DEBUG_REG_I;
+        if(kind[0] == 'v' && (sscanf(kind + 1, "%x", &reg) != 1 || reg > 0xf))
+            return 1;
+        if(strchr("=!<>", op[0]) == NULL || value > 0xfff)
+            return 1;
+        w.type = WATCH_REG;
+        w.reg = (uint8_t)reg;
+        w.op = op[0];
+        w.lo = (uint16_t)value;
+    }
+    else
+        return 1;
+
+    dbg->watches[dbg->count++] = w;
+    return 0;
+}
+
+void debug_remove(struct chip8_debug *dbg, int index)
+{
+    if(index < 0 || index >= dbg->count)
+        return;
+    memmove(&dbg->watches[index], &dbg->watches[index+1],
+        (dbg->count - index - 1) * sizeof(struct debug_watch));
+    dbg->count--;
+}
+
+static void print_watch(const struct debug_watch *w)
+{
+    static const char *const names[] = { "pc", "r", "w", "rw" };
+
+    if(w->type == WATCH_REG)
+    {
+        if(w->reg == DEBUG_REG_I)
+            printf("i %c %X\n", w->op, w->lo);
+        else
+            printf("v%X %c %X\n", w->reg, w->op, w->lo);
+    }
+    else if(w->lo == w->hi)
+        printf("%s %03X\n", names[w->type], w->lo);
+    else
+        printf("%s %03X-%03X\n", names[w->type], w->lo, w->hi);
+}
+
+void debug_list(struct chip8_debug *dbg)
+{
+    for(int i=0; i<dbg->count; i++)
+    {
+        printf("%2d: ", i);
+        print_watch(&dbg->watches[i]);
+    }
+}
+
+void debug_update(struct chip8_debug *dbg, struct chip8 *cpu)
+{
+    const instrp_t *debug_table = cpu_debug_table();
+    int active = dbg->count > 0 || dbg->step;
+
+    if(active && cpu->instr_table != debug_table)
+    {
+        dbg->table = cpu->instr_table;
+        cpu->instr_table = debug_table;
+        cpu->debug = dbg;
+    }
+    else if(!active && cpu->instr_table == debug_table)
+    {
+        cpu->instr_table = dbg->table;
+        cpu->debug = NULL;
+    }
+}
+
+static int overlaps(uint16_t lo, uint16_t hi, const struct debug_watch *w)
+{
+    return lo <= w->hi && hi >= w->lo;
+}
+
+static int check_reg(struct debug_watch *w, struct chip8 *cpu)
+{
+    uint16_t value = w->reg == DEBUG_REG_I ? cpu->i : cpu->v[w->reg];
+    int cond;
+
+    switch(w->op)
+    {
+        case '=': cond = value == w->lo; break;
+        case '!': cond = value != w->lo; break;
+        case '<': cond = value < w->lo; break;
+        default: cond = value > w->lo; break;
+    }
+
+    // only break when the condition becomes true
+    int hit = cond && !w->last;
+    w->last = (uint8_t)cond;
+    return hit;
+}
+
+int debug_check(struct chip8_debug *dbg, struct chip8 *cpu, int id, uint8_t nib0, uint8_t nib1, uint8_t nib2)
+{
+    uint16_t pc = cpu->pc - 2;
+    int hit = -2;
+
+    if(dbg->resume)
+    {
+        dbg->resume = 0;
+        return 0;
+    }
+    if(dbg->step)
+    {
+        dbg->step = 0;
+        hit = -1;
+    }
+
+    // memory accessed through I by this instruction
+    int reads = 0;
+    int writes = 0;
+    uint16_t lo = cpu->i;
+    uint16_t hi = cpu->i;
+    switch(id)
+    {
+        case INSTR_dxyn:
+        {
+            // Dxy0 has 16 rows of 2 bytes, for each selected plane
+            int len = nib2 > 0 ? nib2 : 32;
+            len *= (cpu->planes & 1) + (cpu->planes >> 1 & 1);
+            reads = len > 0;
+            hi = cpu->i + len - 1;
+            break;
+        }
+        case INSTR_fx65: reads = 1; hi = cpu->i + nib0; break;
+        case INSTR_fx33: writes = 1; hi = cpu->i + 2; break;
+        case INSTR_fx55: writes = 1; hi = cpu->i + nib0; break;
+    }
+    (void)nib1;
+
+    // every register watch has to see the values, so check them all and
+    // report the first hit
+    for(int i=0; i<dbg->count; i++)
+    {
+        struct debug_watch *w = &dbg->watches[i];
+        int cond = 0;
+        switch(w->type)
+        {
+            case WATCH_PC:
+                cond = pc >= w->lo && pc <= w->hi;
+                break;
+            case WATCH_READ:
+                cond = reads && overlaps(lo, hi, w);
+                break;
+            case WATCH_WRITE:
+                cond = writes && overlaps(lo, hi, w);
+                break;
+            case WATCH_ACCESS:
+                cond = (reads || writes) && overlaps(lo, hi, w);
+                break;
+            case WATCH_REG:
+                cond = check_reg(w, cpu);
+                break;
+        }
+        if(cond && hit == -2)
+            hit = i;
+    }
+
+    if(hit == -2)
+        return 0;
+
+    // stop in front of the instruction
+    cpu->pc = pc;
+    cpu->paused = 1;
+    dbg->hit = hit;
+    return 1;
+}
+
+static void dump_mem(struct chip8 *cpu, unsigned int addr, unsigned int len)
+{
+    for(unsigned int i=0; i<len; i++)
+    {
+        if(i % 16 == 0)
+            printf("%s%03X:", i ? "\n" : "", (addr + i) & 0xfff);
+        printf(" %02X", cpu->mem[(addr + i) & 0xfff]);
+    }
+    printf("\n");
+}
+
+int debug_prompt(struct chip8_debug *dbg, struct chip8 *cpu)
+{
+    char line[64];
+
+    if(dbg->hit >= 0 && dbg->hit < dbg->count)
+    {
+        printf("break on ");
+        print_watch(&dbg->watches[dbg->hit]);
+    }
+    cpu_dump_state(cpu);
+
+    for(;;)
+    {
+        printf("(chippy) ");
+        fflush(stdout);
+        if(fgets(line, sizeof(line), stdin) == NULL)
+            return 1;
+
+        unsigned int addr, len = 16;
+        int index;
+        if(line[0] == 'c' || line[0] == 's')
+        {
+            dbg->resume = 1;
+            dbg->step = line[0] == 's';
+            dbg->hit = -1;
+            cpu->paused = 0;
+            debug_update(dbg, cpu);
+            return 0;
+        }
+        else if(line[0] == 'p')
+            cpu_dump_state(cpu);
+        else if(line[0] == 'l')
+            debug_list(dbg);
+        else if(line[0] == 'b')
+        {
+            if(debug_add(dbg, line + 1 + strspn(line + 1, " ")) != 0)
+                printf("invalid watch\n");
+            debug_update(dbg, cpu);
+        }
+        else if(line[0] == 'd' && sscanf(line + 1, "%d", &index) == 1)
+        {
+            debug_remove(dbg, index);
+            debug_update(dbg, cpu);
+        }
+        else if(line[0] == 'x' && sscanf(line + 1, "%x %x", &addr, &len) >= 1)
+            dump_mem(cpu, addr, len);
+        else if(line[0] == 'q')
+            return 1;
+        else
+        {
+            printf("c continue, s step, p print state, x ADDR [LEN] dump memory,\n");
+            printf("b WATCH add watch, l list watches, d N delete watch, q quit\n");
+            printf("watches: pc ADDR, r|w|rw ADDR[-ADDR], vX|i =|!|<|> VALUE\n");
+        }
+    }
+}
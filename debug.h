@@ -0,0 +1,66 @@
+#ifndef CHIPPY_DEBUG_H
+#define CHIPPY_DEBUG_H
+
+// Breakpoints and watchpoints. While any are set the cpu runs an
+// instrumented copy of its dispatch table which checks them before each
+// instruction, without watches the normal table is used and costs nothing.
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define DEBUG_MAX_WATCHES 16
+#define DEBUG_REG_I 16 // register index used for I in conditions
+
+enum debug_watch_type
+{
+    WATCH_PC, // break when PC reaches lo
+    WATCH_READ, // break on reads of [lo, hi]
+    WATCH_WRITE, // break on writes to [lo, hi]
+    WATCH_ACCESS, // break on reads or writes of [lo, hi]
+    WATCH_REG // break when reg <op> lo becomes true
+};
+
+struct debug_watch
+{
+    uint8_t type;
+    uint8_t reg; // 0-15 for V0-VF, DEBUG_REG_I
+    char op; // '=', '!', '<', '>'
+    uint8_t last; // condition result before the current instruction
+    uint16_t lo;
+    uint16_t hi;
+};
+
+struct chip8_debug
+{
+    const instrp_t *table; // handlers called after the checks
+    struct debug_watch watches[DEBUG_MAX_WATCHES];
+    int count;
+    int hit; // watch that stopped the cpu, -1 for a step
+    uint8_t resume; // skip the checks for the next instruction
+    uint8_t step; // stop after the next instruction
+};
+
+void debug_init(struct chip8_debug *dbg);
+
+// Adds a watch from a spec like "pc 2a4", "w 300-30f", "r 300",
+// "rw 300-302", "v3 = 10" or "i > 400" (numbers are hex).
+// Returns 0 on success.
+int debug_add(struct chip8_debug *dbg, const char *spec);
+
+void debug_remove(struct chip8_debug *dbg, int index);
+
+void debug_list(struct chip8_debug *dbg);
+
+// Swaps the instrumented dispatch table in or out depending on whether
+// any watches are set or a step is pending, call after changing watches
+void debug_update(struct chip8_debug *dbg, struct chip8 *cpu);
+
+// Called by the instrumented handlers before the instruction runs,
+// pauses the cpu and returns 1 if it must not be executed
+int debug_check(struct chip8_debug *dbg, struct chip8 *cpu, int id, uint8_t nib0, uint8_t nib1, uint8_t nib2);
+
+// Reads commands from stdin while the cpu is paused.
+// Returns 1 if the user asked to quit.
+int debug_prompt(struct chip8_debug *dbg, struct chip8 *cpu);
+
+#endif
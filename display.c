@@ -0,0 +1,36 @@
+#include "display.h"
+
+void display_pack(const struct chip8_display *disp, uint8_t *frame)
+{
+    uint8_t *p = frame;
+    *p++ = disp->hires;
+    for(int plane=0; plane<DISPLAY_PLANES; plane++)
+    {
+        for(int y=0; y<DISPLAY_HEIGHT; y++)
+        {
+            for(int w=0; w<2; w++)
+            {
+                uint64_t word = disp->rows[plane][y][w];
+                for(int k=0; k<8; k++)
+                    *p++ = (uint8_t)(word >> (56 - 8 * k));
+            }
+        }
+    }
+}
+
+int display_width(const uint8_t *frame)
+{
+    return frame[0] ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+}
+
+int display_height(const uint8_t *frame)
+{
+    return frame[0] ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+}
+
+int display_pixel(const uint8_t *frame, int x, int y)
+{
+    const uint8_t *row = frame + 1 + y * DISPLAY_ROW_BYTES + x / 8;
+    uint8_t mask = (uint8_t)(128 >> (x % 8));
+    return ((row[0] & mask) ? 1 : 0) | ((row[DISPLAY_PLANE_SIZE] & mask) ? 2 : 0);
+}
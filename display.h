@@ -0,0 +1,40 @@
+#ifndef CHIPPY_DISPLAY_H
+#define CHIPPY_DISPLAY_H
+
+// The CHIP-8/SCHIP/XO-CHIP display. The cpu keeps every row as a 128 bit
+// word in two halves, so sprites are drawn with a few word XORs and
+// scrolling moves whole rows. Everything outside the cpu (frontends,
+// streams, files) works on the packed frame, made once per frame.
+//
+// Packed frame: a mode byte (1 in hires), then plane 0 and plane 1, each
+// 64 rows of 16 bytes, msb first. Lores uses the first 8 bytes of the
+// first 32 rows, so its rows look like the old packed 64x32 display.
+
+#include <stdint.h>
+
+#define DISPLAY_WIDTH 128 // hires, lores is 64x32
+#define DISPLAY_HEIGHT 64
+#define DISPLAY_PLANES 2 // XO-CHIP bitplanes, CHIP-8 and SCHIP use plane 0
+#define DISPLAY_ROW_BYTES (DISPLAY_WIDTH / 8)
+#define DISPLAY_PLANE_SIZE (DISPLAY_HEIGHT * DISPLAY_ROW_BYTES)
+#define DISPLAY_FRAME_SIZE (1 + DISPLAY_PLANES * DISPLAY_PLANE_SIZE)
+
+struct chip8_display
+{
+    // rows[p][y][0] holds pixels 0-63 of row y of plane p, pixel 0 in the
+    // msb, rows[p][y][1] pixels 64-127
+    uint64_t rows[DISPLAY_PLANES][DISPLAY_HEIGHT][2];
+    uint8_t hires; // 128x64, else 64x32
+};
+
+void display_pack(const struct chip8_display *disp, uint8_t *frame);
+
+// Size of the packed frame's mode
+int display_width(const uint8_t *frame);
+int display_height(const uint8_t *frame);
+
+// Color of a pixel of the packed frame, bit 0 from plane 0, bit 1 from
+// plane 1
+int display_pixel(const uint8_t *frame, int x, int y);
+
+#endif
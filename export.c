@@ -0,0 +1,139 @@
+#include <string.h>
+#include "export.h"
+
+// the colors of the SDL window, luma for y4m
+static const uint8_t rgb[4][3] = { { 0x33, 0x33, 0x33 }, { 0xff, 0xff, 0xff }, { 0xff, 0x88, 0x00 }, { 0x33, 0x99, 0xff } };
+static const uint8_t luma[4] = { 16, 235, 150, 120 };
+
+static const char *const format_names[] = { "raw", "pbm", "ppm", "y4m" };
+
+// larger writes than stdio's default, a hires ppm frame is 24 KiB
+static char file_buf[1 << 16];
+
+int export_parse_format(const char *name)
+{
+    for(int f=0; f<4; f++)
+        if(strcmp(name, format_names[f]) == 0)
+            return f;
+    return -1;
+}
+
+int export_open(struct chip8_export *ex, const char *path, int format, int dedup)
+{
+    memset(ex, 0, sizeof(*ex));
+    ex->fs = fopen(path, "wb");
+    if(ex->fs == NULL)
+        return 1;
+    setvbuf(ex->fs, file_buf, _IOFBF, sizeof(file_buf));
+    ex->format = (uint8_t)format;
+    ex->dedup = (uint8_t)dedup;
+
+    if(format == EXPORT_Y4M)
+    {
+        int n = fprintf(ex->fs, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+        ex->bytes += n > 0 ? (uint64_t)n : 0;
+    }
+    return 0;
+}
+
+// Writes disp shown for repeat frames
+static void write_frame(struct chip8_export *ex, const uint8_t *disp, uint32_t repeat)
+{
+    uint8_t *p = ex->buf;
+    int n = 0;
+    int width = display_width(disp);
+    int height = display_height(disp);
+
+    switch(ex->format)
+    {
+        case EXPORT_RAW:
+            if(ex->dedup)
+            {
+                for(int k=0; k<4; k++)
+                    *p++ = (uint8_t)(repeat >> (8 * k));
+            }
+            memcpy(p, disp, EXPORT_DISP_SIZE);
+            p += EXPORT_DISP_SIZE;
+            break;
+
+        case EXPORT_PBM:
+            // lit if set in any plane, the rows already are P4 rows
+            if(ex->dedup)
+                n = sprintf((char *)p, "P4\n# repeat %u\n%d %d\n", repeat, width, height);
+            else
+                n = sprintf((char *)p, "P4\n%d %d\n", width, height);
+            p += n;
+            for(int y=0; y<height; y++)
+            {
+                const uint8_t *row = disp + 1 + y * DISPLAY_ROW_BYTES;
+                for(int k=0; k<width/8; k++)
+                    *p++ = row[k] | row[k + DISPLAY_PLANE_SIZE];
+            }
+            break;
+
+        case EXPORT_PPM:
+            if(ex->dedup)
+                n = sprintf((char *)p, "P6\n# repeat %u\n%d %d\n255\n", repeat, width, height);
+            else
+                n = sprintf((char *)p, "P6\n%d %d\n255\n", width, height);
+            p += n;
+            for(int y=0; y<height; y++)
+            {
+                for(int x=0; x<width; x++)
+                {
+                    memcpy(p, rgb[display_pixel(disp, x, y)], 3);
+                    p += 3;
+                }
+            }
+            break;
+
+        case EXPORT_Y4M:
+            n = sprintf((char *)p, "FRAME\n");
+            p += n;
+            // always 128x64, lores pixels are 2x2, studio range luma
+            for(int y=0; y<DISPLAY_HEIGHT; y++)
+                for(int x=0; x<DISPLAY_WIDTH; x++)
+                    *p++ = luma[display_pixel(disp, x * width / DISPLAY_WIDTH, y * height / DISPLAY_HEIGHT)];
+            break;
+    }
+
+    size_t len = (size_t)(p - ex->buf);
+    if(fwrite(ex->buf, 1, len, ex->fs) == len)
+        ex->bytes += len;
+    ex->written++;
+}
+
+void export_frame(struct chip8_export *ex, const uint8_t *disp)
+{
+    ex->frames++;
+    if(!ex->dedup)
+    {
+        write_frame(ex, disp, 1);
+        return;
+    }
+
+    // the run is written once the display changes
+    if(ex->repeat > 0 && memcmp(ex->last, disp, EXPORT_DISP_SIZE) == 0)
+    {
+        ex->repeat++;
+        return;
+    }
+    if(ex->repeat > 0)
+        write_frame(ex, ex->last, ex->repeat);
+    memcpy(ex->last, disp, EXPORT_DISP_SIZE);
+    ex->repeat = 1;
+}
+
+int export_close(struct chip8_export *ex)
+{
+    if(ex->fs == NULL)
+        return 0;
+    if(ex->repeat > 0)
+        write_frame(ex, ex->last, ex->repeat);
+    ex->repeat = 0;
+    int result = ferror(ex->fs) != 0;
+    if(fclose(ex->fs) != 0)
+        result = 1;
+    ex->fs = NULL;
+    return result;
+}
@@ -0,0 +1,54 @@
+#ifndef CHIPPY_EXPORT_H
+#define CHIPPY_EXPORT_H
+
+// Writes the display of every frame to a file:
+//   raw  the packed display as is, DISPLAY_FRAME_SIZE bytes per frame
+//   pbm  concatenated binary PBM (P4) images, lit pixels are black
+//   ppm  concatenated binary PPM (P6) images, white on dark grey
+//   y4m  YUV4MPEG2 monochrome 60 fps video, e.g. for ffmpeg
+// pbm and ppm images have the size of the current mode, 64x32 or 128x64,
+// the video is always 128x64.
+// With dedup a run of identical frames is written once with its repeat
+// count: raw frames get a u32 (little endian) count in front, pbm/ppm a
+// "# repeat N" comment. y4m has no repeat count, don't dedup it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "display.h"
+
+#define EXPORT_DISP_SIZE DISPLAY_FRAME_SIZE
+#define EXPORT_MAX_FRAME (DISPLAY_WIDTH * DISPLAY_HEIGHT * 3 + 64)
+
+enum export_format
+{
+    EXPORT_RAW,
+    EXPORT_PBM,
+    EXPORT_PPM,
+    EXPORT_Y4M
+};
+
+struct chip8_export
+{
+    FILE *fs;
+    uint8_t format;
+    uint8_t dedup;
+    uint32_t repeat; // frames equal to last not written yet
+    uint8_t last[EXPORT_DISP_SIZE];
+    uint64_t frames; // frames exported
+    uint64_t written; // frames written, smaller with dedup
+    uint64_t bytes;
+    uint8_t buf[EXPORT_MAX_FRAME];
+};
+
+// Returns the format for raw, pbm, ppm or y4m, -1 otherwise
+int export_parse_format(const char *name);
+
+// Returns 0 on success
+int export_open(struct chip8_export *ex, const char *path, int format, int dedup);
+
+void export_frame(struct chip8_export *ex, const uint8_t *disp);
+
+// Writes a pending dedup run, returns 0 if everything was written
+int export_close(struct chip8_export *ex);
+
+#endif
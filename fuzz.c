@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+
+// In-process fuzz target for the cpu core. An input is a config byte, two
+// bytes of keys and the ROM. Bits 0-2 of the config pick the quirk
+// profile, bit 3 enables CPU_HALT_JUMP and bit 4 CPU_HALT_HASH (which
+// hashes the state at every tick, about half the time of a run).
+// The ROM runs FUZZ_CYCLES cycles, the keys are pressed halfway. Every run
+// starts from a snapshot copy instead of cpu_init.
+//
+// With CHIPPY_FUZZ_DIFF set in the environment each input also runs on
+// cpu_cycle alone and the run aborts if the final states differ from
+// cpu_run's, which fuses instructions and batches the timers.
+//
+// libFuzzer: clang -fsanitize=fuzzer,address -DCHIPPY_LIBFUZZER fuzz.c
+//            cpu.c trace.c lz.c debug.c profile.c
+// Otherwise fuzz.c has a main which runs the files given (AFL style,
+// stdin without arguments, __AFL_LOOP persistent mode with afl-clang-fast)
+// or measures throughput with --bench N.
+
+#ifndef FUZZ_CYCLES
+#define FUZZ_CYCLES 500 // about one second of guest time
+#endif
+
+#define FUZZ_HEADER 3
+
+static struct chip8 snapshot;
+static struct chip8 cpu;
+static struct chip8 ref;
+static int diff;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    (void)argc;
+    (void)argv;
+    cpu_init(&snapshot);
+    diff = getenv("CHIPPY_FUZZ_DIFF") != NULL;
+    return 0;
+}
+
+static int same_state(const struct chip8 *a, const struct chip8 *b)
+{
+    return memcmp(a->mem, b->mem, sizeof(a->mem)) == 0
+        && memcmp(a->v, b->v, sizeof(a->v)) == 0
+        && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0
+        && memcmp(a->disp.rows, b->disp.rows, sizeof(a->disp.rows)) == 0
+        && a->disp.hires == b->disp.hires && a->planes == b->planes
+        && a->i == b->i && a->pc == b->pc && a->sp == b->sp
+        && a->keys == b->keys && a->wait_key == b->wait_key
+        && a->status == b->status && a->rng == b->rng
+        && a->cycles == b->cycles && a->next_tick == b->next_tick
+        && a->dt_end == b->dt_end && a->st_end == b->st_end;
+}
+
+static void load(struct chip8 *c, const uint8_t *data, size_t size)
+{
+    size_t len = size - FUZZ_HEADER;
+    if(len > CPU_MEM_SIZE - CPU_ROM_ADDR)
+        len = CPU_MEM_SIZE - CPU_ROM_ADDR;
+    *c = snapshot;
+    memcpy(c->mem + CPU_ROM_ADDR, data + FUZZ_HEADER, len);
+    cpu_set_quirks(c, (enum quirks)((data[0] & 7) % QUIRKS_COUNT));
+    c->halt_check = (data[0] >> 3) & (CPU_HALT_JUMP | CPU_HALT_HASH);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if(size <= FUZZ_HEADER)
+        return 0;
+    uint16_t keys = (uint16_t)(data[1] | data[2] << 8);
+
+    load(&cpu, data, size);
+    cpu_run(&cpu, FUZZ_CYCLES / 2);
+    cpu_set_keys(&cpu, keys);
+    cpu_run(&cpu, FUZZ_CYCLES - FUZZ_CYCLES / 2);
+    if(cpu.sp > CPU_STACK_SIZE || cpu.status > CPU_BAD_OPCODE)
+        abort();
+
+    if(diff)
+    {
+        load(&ref, data, size);
+        for(int c=0; c<FUZZ_CYCLES / 2; c++)
+            cpu_cycle(&ref);
+        cpu_set_keys(&ref, keys);
+        for(int c=FUZZ_CYCLES / 2; c<FUZZ_CYCLES; c++)
+            cpu_cycle(&ref);
+        if(!same_state(&cpu, &ref))
+        {
+            printf("cpu_run and cpu_cycle differ\n");
+            cpu_dump_state(&cpu);
+            cpu_dump_state(&ref);
+            abort();
+        }
+    }
+    return 0;
+}
+
+#ifndef CHIPPY_LIBFUZZER
+
+#define FUZZ_MAX_INPUT (FUZZ_HEADER + CPU_MEM_SIZE)
+
+static uint8_t input[FUZZ_MAX_INPUT];
+
+#ifndef __AFL_LOOP
+#define __AFL_LOOP(n) (runs++ == 0)
+#endif
+
+static int run_file(FILE *fs)
+{
+    size_t len = fread(input, 1, sizeof(input), fs);
+    return LLVMFuzzerTestOneInput(input, len);
+}
+
+static uint32_t xorshift(uint32_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+#define FUZZ_BENCH_ROM 256
+
+// A random opcode which decodes to an instruction (not 00FD, which
+// stops at once), operands are random but jumps and calls stay in the ROM
+// (else most runs slide through zeroed memory)
+static uint16_t random_opcode(uint32_t r)
+{
+    static const uint8_t group0[] = { 0xe0, 0xee, 0xc1, 0xd1, 0xfb, 0xfc, 0xfe, 0xff };
+    static const uint8_t group8[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xe };
+    static const uint8_t groupf[] = { 0x07, 0x0a, 0x15, 0x18, 0x1e, 0x29, 0x30, 0x33, 0x55, 0x65 };
+    uint16_t op = (uint16_t)r;
+    uint32_t pick = r >> 16;
+
+    switch(op >> 12)
+    {
+        case 0x0: return group0[pick % sizeof(group0)];
+        case 0x1: case 0x2: case 0xb:
+            return (uint16_t)((op & 0xf000) | (CPU_ROM_ADDR + (pick % FUZZ_BENCH_ROM & ~1u)));
+        case 0x5: case 0x9: return op & 0xfff0;
+        case 0x8: return (uint16_t)((op & 0xfff0) | group8[pick % sizeof(group8)]);
+        case 0xe: return (op & 0xff00) | (pick & 1 ? 0x9e : 0xa1);
+        case 0xf: return (uint16_t)((op & 0xff00) | groupf[pick % sizeof(groupf)]);
+        default: return op;
+    }
+}
+
+// Random ROMs of valid opcodes, prints executions per second
+static int bench(long n)
+{
+    uint32_t x = 1234;
+    size_t len = FUZZ_HEADER + FUZZ_BENCH_ROM;
+
+    clock_t start = clock();
+    for(long r=0; r<n; r++)
+    {
+        for(size_t k=0; k<FUZZ_HEADER; k++)
+            input[k] = (uint8_t)xorshift(&x);
+        for(size_t k=FUZZ_HEADER; k<len; k+=2)
+        {
+            uint16_t op = random_opcode(xorshift(&x));
+            input[k] = (uint8_t)(op >> 8);
+            input[k + 1] = (uint8_t)op;
+        }
+        LLVMFuzzerTestOneInput(input, len);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%ld executions in %.2f s, %.0f per second\n", n, seconds, seconds > 0 ? n / seconds : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 0;
+
+    LLVMFuzzerInitialize(&argc, &argv);
+    if(argc == 3 && strcmp(argv[1], "--bench") == 0)
+        return bench(atol(argv[2]));
+    if(argc > 1)
+    {
+        for(int i=1; i<argc; i++)
+        {
+            FILE *fs = fopen(argv[i], "rb");
+            if(fs == NULL)
+            {
+                printf("Failed to open %s\n", argv[i]);
+                return 1;
+            }
+            run_file(fs);
+            fclose(fs);
+        }
+        return 0;
+    }
+    while(__AFL_LOOP(10000))
+        run_file(stdin);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <string.h>
+#include "inputlog.h"
+
+int input_log_record(struct input_log *log, const char *path)
+{
+    memset(log, 0, sizeof(*log));
+    log->fs = fopen(path, "w");
+    return log->fs == NULL;
+}
+
+void input_log_write(struct input_log *log, uint64_t frame, uint16_t keys)
+{
+    if(keys == log->keys)
+        return;
+    log->keys = keys;
+    fprintf(log->fs, "%llu %04x\n", (unsigned long long)frame, keys);
+}
+
+static void read_next(struct input_log *log)
+{
+    unsigned long long frame;
+    unsigned int keys;
+
+    log->pending = fscanf(log->fs, "%llu %x", &frame, &keys) == 2;
+    log->next_frame = frame;
+    log->next_keys = (uint16_t)keys;
+}
+
+int input_log_replay(struct input_log *log, const char *path)
+{
+    memset(log, 0, sizeof(*log));
+    log->fs = fopen(path, "r");
+    if(log->fs == NULL)
+        return 1;
+    read_next(log);
+    return 0;
+}
+
+uint16_t input_log_keys(struct input_log *log, uint64_t frame)
+{
+    while(log->pending && log->next_frame <= frame)
+    {
+        log->keys = log->next_keys;
+        read_next(log);
+    }
+    return log->keys;
+}
+
+int input_log_next(struct input_log *log, uint64_t *frame, uint16_t *keys)
+{
+    if(!log->pending)
+        return 0;
+    *frame = log->next_frame;
+    *keys = log->next_keys;
+    log->keys = log->next_keys;
+    read_next(log);
+    return 1;
+}
+
+void input_log_close(struct input_log *log)
+{
+    if(log->fs != NULL)
+        fclose(log->fs);
+    log->fs = NULL;
+}
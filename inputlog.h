@@ -0,0 +1,38 @@
+#ifndef CHIPPY_INPUTLOG_H
+#define CHIPPY_INPUTLOG_H
+
+// Recorded key input, one text line "FRAME KEYS" (decimal frame, hex
+// mask of the held keys) whenever the keys change. The keys of frame n
+// are set after its cycles ran, like the main loop does, so a replay
+// with the same ROM and quirks reproduces the run.
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct input_log
+{
+    FILE *fs;
+    uint16_t keys; // current mask
+    int pending; // next_frame/next_keys hold a line not applied yet
+    uint64_t next_frame;
+    uint16_t next_keys;
+};
+
+// Returns 0 on success
+int input_log_record(struct input_log *log, const char *path);
+
+// Records the keys held in frame, only changes are written
+void input_log_write(struct input_log *log, uint64_t frame, uint16_t keys);
+
+// Returns 0 on success
+int input_log_replay(struct input_log *log, const char *path);
+
+// Returns the keys held in frame, frames must be asked in order
+uint16_t input_log_keys(struct input_log *log, uint64_t frame);
+
+// Reads the next key change of a replayed log, returns 0 at the end
+int input_log_next(struct input_log *log, uint64_t *frame, uint16_t *keys);
+
+void input_log_close(struct input_log *log);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef CHIPPY_INSTR_H
+#define CHIPPY_INSTR_H
+
+// List of all instruction handlers, X(name, mnemonic, quirk)
+// name is pasted into instr_<name> and INSTR_<name>, quirk names the
+// behaviour that differs between interpreters (none for fixed ones),
+// the handler for those is instr_<name>_<variant>, see cpu.c
+#define INSTR_LIST(X) \
+    X(0nnn, "0nnn - SYS addr", none) \
+    X(00e0, "00E0 - CLS", none) \
+    X(00ee, "00EE - RET", none) \
+    X(00cn, "00Cn - SCD nibble", none) \
+    X(00dn, "00Dn - SCU nibble", none) \
+    X(00fb, "00FB - SCR", none) \
+    X(00fc, "00FC - SCL", none) \
+    X(00fd, "00FD - EXIT", none) \
+    X(00fe, "00FE - LOW", none) \
+    X(00ff, "00FF - HIGH", none) \
+    X(1nnn, "1nnn - JP addr", none) \
+    X(2nnn, "2nnn - CALL addr", none) \
+    X(3xkk, "3xkk - SE Vx, byte", none) \
+    X(4xkk, "4xkk - SNE Vx, byte", none) \
+    X(5xy0, "5xy0 - SE Vx, Vy", none) \
+    X(6xkk, "6xkk - LD Vx, byte", none) \
+    X(7xkk, "7xkk - ADD Vx, byte", none) \
+    X(8xy0, "8xy0 - LD Vx, Vy", none) \
+    X(8xy1, "8xy1 - OR Vx, Vy", logic) \
+    X(8xy2, "8xy2 - AND Vx, Vy", logic) \
+    X(8xy3, "8xy3 - XOR Vx, Vy", logic) \
+    X(8xy4, "8xy4 - ADD Vx, Vy", none) \
+    X(8xy5, "8xy5 - SUB Vx, Vy", none) \
+    X(8xy6, "8xy6 - SHR Vx {, Vy}", shr) \
+    X(8xy7, "8xy7 - SUBN Vx, Vy", none) \
+    X(8xye, "8xyE - SHL Vx {, Vy}", shl) \
+    X(9xy0, "9xy0 - SNE Vx, Vy", none) \
+    X(annn, "Annn - LD I, addr", none) \
+    X(bnnn, "Bnnn - JP V0, addr", jump) \
+    X(cxkk, "Cxkk - RND Vx, byte", none) \
+    X(dxyn, "Dxyn - DRW Vx, Vy, nibble", draw) \
+    X(ex9e, "Ex9E - SKP Vx", none) \
+    X(exa1, "ExA1 - SKNP Vx", none) \
+    X(fn01, "Fn01 - PLANE n", none) \
+    X(fx07, "Fx07 - LD Vx, DT", none) \
+    X(fx0a, "Fx0A - LD Vx, K", none) \
+    X(fx15, "Fx15 - LD DT, Vx", none) \
+    X(fx18, "Fx18 - LD ST, Vx", none) \
+    X(fx1e, "Fx1E - ADD I, Vx", none) \
+    X(fx29, "Fx29 - LD F, Vx", none) \
+    X(fx30, "Fx30 - LD HF, Vx", none) \
+    X(fx33, "Fx33 - LD B, Vx", none) \
+    X(fx55, "Fx55 - LD [I], Vx", load) \
+    X(fx65, "Fx65 - LD Vx, [I]", load) \
+    X(dummy, "???? - not implemented", none)
+
+enum instr_id
+{
+#define INSTR_ENUM(name, mnemonic, quirk) INSTR_##name,
+    INSTR_LIST(INSTR_ENUM)
+#undef INSTR_ENUM
+    INSTR_COUNT
+};
+
+const char *instr_mnemonic(int id);
+
+#endif
@@ -0,0 +1,135 @@
+#include <string.h>
+#include "lz.h"
+
+#define MIN_MATCH 4
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *write_length(uint8_t *op, uint32_t len)
+{
+    while(len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint8_t *token = op++;
+    uint32_t m = match_len ? match_len - MIN_MATCH : 0;
+
+    *token = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (m < 15 ? m : 15));
+    if(lit_len >= 15)
+        op = write_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if(match_len == 0)
+        return op; // last sequence, literals only
+
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    if(m >= 15)
+        op = write_length(op, m - 15);
+    return op;
+}
+
+uint32_t lz_compress(struct lz_state *lz, const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    uint8_t *op = out;
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+
+    memset(lz->table, 0, sizeof(lz->table));
+
+    while(ip + MIN_MATCH <= len)
+    {
+        uint32_t seq = read32(in + ip);
+        uint32_t h = hash32(seq);
+        uint32_t ref = lz->table[h];
+        lz->table[h] = (uint16_t)ip;
+
+        if(ref >= ip || read32(in + ref) != seq)
+        {
+            ip++;
+            continue;
+        }
+
+        uint32_t match_len = MIN_MATCH;
+        while(ip + match_len < len && in[ref + match_len] == in[ip + match_len])
+            match_len++;
+
+        op = write_sequence(op, in + anchor, ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, in + anchor, len - anchor, 0, 0);
+    return (uint32_t)(op - out);
+}
+
+static int read_length(const uint8_t **ip, const uint8_t *end, uint32_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if(*ip >= end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while(b == 255);
+    return 0;
+}
+
+int32_t lz_decompress(const uint8_t *in, uint32_t len, uint8_t *out, uint32_t out_cap)
+{
+    const uint8_t *ip = in;
+    const uint8_t *end = in + len;
+    uint32_t op = 0;
+
+    while(ip < end)
+    {
+        uint8_t token = *ip++;
+
+        uint32_t lit_len = token >> 4;
+        if(lit_len == 15 && read_length(&ip, end, &lit_len) != 0)
+            return -1;
+        if(lit_len > (uint32_t)(end - ip) || lit_len > out_cap - op)
+            return -1;
+        memcpy(out + op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if(ip == end)
+            break; // last sequence
+
+        if(end - ip < 2)
+            return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        uint32_t match_len = token & 0xf;
+        if(match_len == 15 && read_length(&ip, end, &match_len) != 0)
+            return -1;
+        match_len += MIN_MATCH;
+
+        if(offset == 0 || offset > op || match_len > out_cap - op)
+            return -1;
+        // byte by byte, matches may overlap their own output
+        for(uint32_t i=0; i<match_len; i++, op++)
+            out[op] = out[op - offset];
+    }
+    return (int32_t)op;
+}
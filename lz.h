@@ -0,0 +1,26 @@
+#ifndef CHIPPY_LZ_H
+#define CHIPPY_LZ_H
+
+#include <stdint.h>
+
+// Small LZ77 block compressor (LZ4 style token stream), fast enough to
+// compress trace blocks inline. Blocks are at most LZ_MAX_BLOCK bytes.
+
+#define LZ_MAX_BLOCK (1 << 16)
+#define LZ_HASH_BITS 12
+
+// worst case size of the compressed data for n input bytes
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+struct lz_state
+{
+    uint16_t table[1 << LZ_HASH_BITS]; // last position per hash
+};
+
+// Returns the compressed size, out must hold LZ_BOUND(len) bytes
+uint32_t lz_compress(struct lz_state *lz, const uint8_t *in, uint32_t len, uint8_t *out);
+
+// Returns the decompressed size or -1 if the data is corrupt
+int32_t lz_decompress(const uint8_t *in, uint32_t len, uint8_t *out, uint32_t out_cap);
+
+#endif
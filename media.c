@@ -1,243 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
-#include <math.h>
-
-#ifdef _WIN32
-#include <SDL.h>
-#include <SDL_audio.h>
-#else
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_audio.h>
-#endif
-
+#include <string.h>
 #include "media.h"
 
-#define SPEAKER_FREQ 440
-#define SAMPLING_FREQ 44100
-
-#define PI2 6.283185307179586
-
-#define WINDOW_WIDTH 640
-#define WINDOW_HEIGHT 480
-
-static const float TONE_INC = (float)(PI2 *  SPEAKER_FREQ / SAMPLING_FREQ);
+static const struct media_backend *const backends[] =
+{
+    &media_sdl,
+    &media_term,
+    &media_null,
+    &media_file,
+    NULL
+};
 
-static void audio_callback(void* user_data, uint8_t* stream, int len)
+int media_init(struct chip8_media *media, const char *spec)
 {
-    float* last_tone = (float*)user_data;
+    const char *colon = strchr(spec, ':');
+    size_t len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
 
-    for (int i = 0; i < len; i++)
+    memset(media, 0, sizeof(*media));
+    media->arg = colon != NULL ? colon + 1 : NULL;
+    for (int i = 0; backends[i] != NULL; i++)
     {
-        stream[i] = (uint8_t) (sinf(*last_tone) + 127);
-        (*last_tone) += TONE_INC;
+        if (strlen(backends[i]->name) == len && strncmp(backends[i]->name, spec, len) == 0)
+            media->backend = backends[i];
     }
-}
-
-static int init_audio(struct sdl_audio *sa)
-{
-    sa->last_tone = 0;
-
-    sa->audio_spec.freq = SAMPLING_FREQ; // number of samples per second
-    sa->audio_spec.format = AUDIO_U8; // sample type (here: unsigned 8 bit)
-    sa->audio_spec.channels = 1; // only one channel
-    sa->audio_spec.samples = 4096; // buffer-size
-    sa->audio_spec.callback = audio_callback; // function SDL calls periodically to refill the buffer
-    sa->audio_spec.userdata = &sa->last_tone; // counter, keeping track of current sample number
-    SDL_AudioSpec have;
-
-    sa->audio_dev = SDL_OpenAudioDevice(NULL, 0, &sa->audio_spec, &have, 0);
-
-    if (sa->audio_dev == 0)
+    if (media->backend == NULL)
     {
-        SDL_LogError(SDL_LOG_CATEGORY_AUDIO, "Failed to open audio: %s", SDL_GetError());
+        printf("Unknown media %s, use sdl, term, null or file:PATH\n", spec);
         return 1;
     }
-
-    if (sa->audio_spec.format != have.format)
+    if (media->backend->init(media) != 0)
     {
-        SDL_LogError(SDL_LOG_CATEGORY_AUDIO, "Failed to get the desired audio spec");
+        media->backend = NULL;
         return 1;
     }
     return 0;
 }
 
-static void close_sound(struct sdl_audio *sa)
+void media_close(struct chip8_media *media)
 {
-    if(sa->audio_dev != 0)
-        SDL_CloseAudioDevice(sa->audio_dev);
-    sa->audio_dev = 0;
+    if (media->backend != NULL)
+        media->backend->close(media);
+    media->backend = NULL;
 }
 
-static int init_graphics(struct sdl_graphics *sg)
+void media_present(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph)
 {
-    sg->window = SDL_CreateWindow("Chippy",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        WINDOW_WIDTH, WINDOW_HEIGHT,
-        SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL);
-
-    if(sg->window == NULL)
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create window: %s", SDL_GetError());
-        return 1;
-    }
-
-    SDL_SetWindowMinimumSize(sg->window, TEXTURE_WIDTH, TEXTURE_HEIGHT);
-
-    sg->renderer = SDL_CreateRenderer(sg->window, -1, SDL_RENDERER_PRESENTVSYNC);
-
-    if(sg->renderer == NULL)
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create renderer: %s", SDL_GetError());
-        return 1;
-    }
-
-    if(SDL_RenderSetLogicalSize(sg->renderer, TEXTURE_WIDTH, TEXTURE_HEIGHT) != 0)
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Failed to set logical size: %s", SDL_GetError());
-        return 1;
-    }
-
-    if(SDL_RenderSetIntegerScale(sg->renderer, 1) != 0)
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Failed to set scaling: %s", SDL_GetError());
-        return 1;
-    }
-
-    sg->texture = SDL_CreateTexture(sg->renderer,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
-        TEXTURE_WIDTH, TEXTURE_HEIGHT);
-
-    if(sg->texture == NULL)
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create texture: %s", SDL_GetError());
-        return 1;
-    }
-
-    return 0;
+    media->backend->present(media, disp, graph);
 }
 
-static void close_graphics(struct sdl_graphics *sg)
+void media_set_title(struct chip8_media *media, const char *title)
 {
-    if (sg->texture != NULL)
-        SDL_DestroyTexture(sg->texture);
-    sg->texture = NULL;
-
-    if (sg->renderer != NULL)
-        SDL_DestroyRenderer(sg->renderer);
-    sg->renderer = NULL;
-
-    if (sg->window != NULL)
-        SDL_DestroyWindow(sg->window);
-    sg->window = NULL;
+    media->backend->set_title(media, title);
 }
 
-int media_init(struct chip8_media *media)
+void media_set_buzzer(struct chip8_media *media, int active)
 {
-    if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO) != 0) 
-    {
-        SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
-        return 1;
-    }
-
-    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Initializing media");
-
-    if (init_audio(&media->audio) != 0)
-        return 1;
+    media->backend->set_buzzer(media, active);
+}
 
-    if (init_graphics(&media->graphics) != 0)
-        return 1;
-    return 0;
+int media_poll_exit_requested(struct chip8_media *media)
+{
+    return media->backend->poll_exit(media);
 }
 
-void media_close(struct chip8_media *media)
+int media_poll_key_down(struct chip8_media *media, uint8_t key)
 {
-    close_sound(&media->audio);
-    close_graphics(&media->graphics);
+    return media->backend->key_down(media, key);
+}
 
-    SDL_Quit();
+uint64_t media_us_elapsed(struct chip8_media *media)
+{
+    return media->backend->us_elapsed(media);
 }
 
-void media_set_pixel(struct chip8_media *media, int x, int y, int active)
+uint32_t media_ms_elapsed(struct chip8_media *media)
 {
-    if(active)
-        media->graphics.pixels[x + y * TEXTURE_WIDTH] = 0xffffffff;
-    else
-        media->graphics.pixels[x + y * TEXTURE_WIDTH] = 0x333333ff;
+    return (uint32_t)(media_us_elapsed(media) / 1000);
 }
 
-void media_set_pixel_dbg(struct chip8_media *media, int x, int y, int active)
+void media_ms_delay(struct chip8_media *media, uint32_t ms)
 {
-    if(active)
-        media->graphics.pixels[x + y * TEXTURE_WIDTH] = 0x00ff002f;
-    else
-        media->graphics.pixels[x + y * TEXTURE_WIDTH] = 0xff00002f;
+    uint64_t start = media_us_elapsed(media);
+    media->backend->delay_us(media, ms * 1000);
+    uint64_t slept = media_us_elapsed(media) - start;
+
+    media->stats.sleeps++;
+    if (slept > (uint64_t)ms * 1000)
+    {
+        uint32_t overshoot = (uint32_t)(slept - (uint64_t)ms * 1000);
+        media->stats.sleep_overshoot_us += overshoot;
+        if (overshoot > media->stats.sleep_overshoot_max_us)
+            media->stats.sleep_overshoot_max_us = overshoot;
+    }
 }
 
-void media_set_buzzer(struct chip8_media *media, int active)
+int media_wall_init(struct chip8_media *media, int count)
 {
-    if (active)
-        SDL_PauseAudioDevice(media->audio.audio_dev, 0);
-    else
-        SDL_PauseAudioDevice(media->audio.audio_dev, 1);
+    if (media->backend->wall_init == NULL)
+        return 1;
+    return media->backend->wall_init(media, count);
 }
 
-void media_render(struct chip8_media *media)
+void media_wall_update(struct chip8_media *media, int index, const uint8_t *disp)
 {
-    SDL_RenderClear(media->graphics.renderer);
-    SDL_UpdateTexture(media->graphics.texture, NULL, media->graphics.pixels, TEXTURE_WIDTH * 4);
-    SDL_RenderCopy(media->graphics.renderer, media->graphics.texture, NULL, NULL);
-    SDL_RenderPresent(media->graphics.renderer);
+    media->backend->wall_update(media, index, disp);
 }
 
-int media_poll_exit_requested(struct chip8_media *media)
+void media_wall_render(struct chip8_media *media)
 {
-    SDL_Event ev;
-    while (SDL_PollEvent(&ev))
-    {
-        if (ev.type == SDL_QUIT)
-            return 1;
-    }
-    return 0;
+    media->backend->wall_render(media);
 }
 
-const int chip8_to_sdl_keymap[] =
-{
-    SDL_SCANCODE_X, // 0
-    SDL_SCANCODE_1, // 1
-    SDL_SCANCODE_2, // 2
-    SDL_SCANCODE_3, // 3
-    SDL_SCANCODE_Q, // 4
-    SDL_SCANCODE_W, // 5
-    SDL_SCANCODE_E, // 6
-    SDL_SCANCODE_A, // 7
-    SDL_SCANCODE_S, // 8
-    SDL_SCANCODE_D, // 9
-    SDL_SCANCODE_Y, // A
-    SDL_SCANCODE_C, // B
-    SDL_SCANCODE_4, // C
-    SDL_SCANCODE_R, // D
-    SDL_SCANCODE_F, // E
-    SDL_SCANCODE_V  // F
-};
+#ifdef _WIN32
+#include <windows.h>
 
-int media_poll_key_down(struct chip8_media *media, uint8_t chip8_key)
+uint64_t media_clock_us(struct chip8_media *media)
 {
-    const Uint8* sdl_keystate;
-
-    if (chip8_key < 0 || chip8_key > 15) return 0;
-    SDL_PumpEvents(); // required?
-    sdl_keystate = SDL_GetKeyboardState(NULL);
-    int sdl_key = chip8_to_sdl_keymap[chip8_key];
+    LARGE_INTEGER counter, freq;
+    (void)media;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(counter.QuadPart / freq.QuadPart) * 1000000
+        + (uint64_t)(counter.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+}
 
-    return sdl_keystate[sdl_key];
+void media_sleep_us(struct chip8_media *media, uint32_t us)
+{
+    (void)media;
+    Sleep(us / 1000);
 }
+#else
+#include <time.h>
 
-uint32_t media_ms_elapsed(struct chip8_media *media)
+uint64_t media_clock_us(struct chip8_media *media)
 {
-    return SDL_GetTicks();
+    struct timespec ts;
+    (void)media;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
-void media_ms_delay(struct chip8_media *media, uint32_t ms)
+void media_sleep_us(struct chip8_media *media, uint32_t us)
 {
-    SDL_Delay(ms);
+    struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+    (void)media;
+    nanosleep(&ts, NULL);
 }
+#endif
@@ -1,51 +1,77 @@
 #ifndef CHIPPY_MEDIA_H
 #define CHIPPY_MEDIA_H
 
+// Display, sound, input and timing behind a backend table chosen at
+// runtime, "sdl" (default), "term", "null" (no output, unthrottled, for
+// benchmarks) or "file" (raw frames to a file, unthrottled). SDL is
+// loaded when its backend is initialized, so the others run on hosts
+// without it.
+
 #include <stdint.h>
-#ifdef _WIN32
-#include <SDL.h>
-#include <SDL_audio.h>
-#else
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_audio.h>
-#endif
+#include "stats.h"
+#include "display.h"
+
+// lores is drawn with 2x2 texels per pixel
+#define TEXTURE_WIDTH DISPLAY_WIDTH
+#define TEXTURE_HEIGHT DISPLAY_HEIGHT
+#define MEDIA_DISP_SIZE DISPLAY_FRAME_SIZE
+#define MEDIA_WALL_MAX 256
 
-#define TEXTURE_WIDTH 64
-#define TEXTURE_HEIGHT 32
+struct chip8_media;
 
-struct sdl_audio
+// Frame time graph drawn over the bottom of the screen, one column per
+// frame, the budget is 8 px high and slower frames are drawn red
+struct media_graph
 {
-    float last_tone;
-    SDL_AudioSpec audio_spec;
-    SDL_AudioDeviceID audio_dev;
+    const uint32_t *frame_us;
+    int count;
+    int pos;
+    uint32_t budget_us;
 };
 
-struct sdl_graphics
+struct media_backend
 {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture* texture;
-    unsigned int pixels[TEXTURE_WIDTH * TEXTURE_HEIGHT * 4];
+    const char *name;
+    int (*init)(struct chip8_media *media);
+    void (*close)(struct chip8_media *media);
+    // disp is the packed display, see display.h
+    void (*present)(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph);
+    void (*set_buzzer)(struct chip8_media *media, int active);
+    void (*set_title)(struct chip8_media *media, const char *title);
+    int (*poll_exit)(struct chip8_media *media);
+    int (*key_down)(struct chip8_media *media, uint8_t key);
+    uint64_t (*us_elapsed)(struct chip8_media *media);
+    void (*delay_us)(struct chip8_media *media, uint32_t us);
+    // spectator wall, NULL if the backend has none
+    int (*wall_init)(struct chip8_media *media, int count);
+    void (*wall_update)(struct chip8_media *media, int index, const uint8_t *disp);
+    void (*wall_render)(struct chip8_media *media);
 };
 
 struct chip8_media
 {
-    struct sdl_audio audio;
-    struct sdl_graphics graphics;
+    const struct media_backend *backend;
+    const char *arg; // text after the ':' of the backend name
+    struct media_stats stats;
 };
 
-int media_init(struct chip8_media *media);
+extern const struct media_backend media_sdl;
+extern const struct media_backend media_term;
+extern const struct media_backend media_null;
+extern const struct media_backend media_file;
+
+// spec is a backend name, optionally followed by ":ARG" (file:PATH)
+int media_init(struct chip8_media *media, const char *spec);
 
 void media_close(struct chip8_media *media);
 
-void media_set_pixel(struct chip8_media *media, int x, int y, int active);
+// Shows the display, graph may be NULL
+void media_present(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph);
 
-void media_set_pixel_dbg(struct chip8_media *media, int x, int y, int active);
+void media_set_title(struct chip8_media *media, const char *title);
 
 void media_set_buzzer(struct chip8_media *media, int active);
 
-void media_render(struct chip8_media *media);
-
 int media_poll_exit_requested(struct chip8_media *media);
 
 int media_poll_key_down(struct chip8_media *media, uint8_t key);
@@ -54,4 +80,20 @@ uint32_t media_ms_elapsed(struct chip8_media *media);
 
 void media_ms_delay(struct chip8_media *media, uint32_t ms);
 
-#endif
\ No newline at end of file
+uint64_t media_us_elapsed(struct chip8_media *media);
+
+// Switches to a wall of count tiles (at most MEDIA_WALL_MAX),
+// returns 0 on success, 1 if the backend can't show one
+int media_wall_init(struct chip8_media *media, int count);
+
+// Updates tile index from a packed display
+void media_wall_update(struct chip8_media *media, int index, const uint8_t *disp);
+
+// Presents the whole wall
+void media_wall_render(struct chip8_media *media);
+
+// Host clock and sleep for backends without their own
+uint64_t media_clock_us(struct chip8_media *media);
+void media_sleep_us(struct chip8_media *media, uint32_t us);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include "media.h"
+
+// Backends without a window, they don't wait so the main loop runs as
+// fast as the host allows. null drops the frames, file appends each
+// presented display as a packed frame (display.h) to the file given as file:PATH.
+
+static FILE *sink;
+static uint64_t sink_frames;
+
+static int null_init(struct chip8_media *media)
+{
+    (void)media;
+    return 0;
+}
+
+static void null_close(struct chip8_media *media)
+{
+    (void)media;
+}
+
+static void null_present(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph)
+{
+    (void)media;
+    (void)disp;
+    (void)graph;
+}
+
+static void null_set_buzzer(struct chip8_media *media, int active)
+{
+    (void)media;
+    (void)active;
+}
+
+static void null_set_title(struct chip8_media *media, const char *title)
+{
+    (void)media;
+    (void)title;
+}
+
+static int null_poll_exit(struct chip8_media *media)
+{
+    (void)media;
+    return 0;
+}
+
+static int null_key_down(struct chip8_media *media, uint8_t key)
+{
+    (void)media;
+    (void)key;
+    return 0;
+}
+
+static void null_delay_us(struct chip8_media *media, uint32_t us)
+{
+    (void)media;
+    (void)us;
+}
+
+const struct media_backend media_null =
+{
+    "null",
+    null_init,
+    null_close,
+    null_present,
+    null_set_buzzer,
+    null_set_title,
+    null_poll_exit,
+    null_key_down,
+    media_clock_us,
+    null_delay_us,
+    NULL,
+    NULL,
+    NULL
+};
+
+static int file_init(struct chip8_media *media)
+{
+    if (media->arg == NULL || (sink = fopen(media->arg, "wb")) == NULL)
+    {
+        printf("Failed to open frame file %s\n", media->arg ? media->arg : "(none), use file:PATH");
+        return 1;
+    }
+    sink_frames = 0;
+    return 0;
+}
+
+static void file_close(struct chip8_media *media)
+{
+    if (sink == NULL)
+        return;
+    if (fclose(sink) != 0)
+        printf("Failed to write frame file %s\n", media->arg);
+    else
+        printf("Wrote %llu frames to %s\n", (unsigned long long)sink_frames, media->arg);
+    sink = NULL;
+}
+
+static void file_present(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph)
+{
+    (void)media;
+    (void)graph;
+    if (fwrite(disp, MEDIA_DISP_SIZE, 1, sink) == 1)
+        sink_frames++;
+}
+
+const struct media_backend media_file =
+{
+    "file",
+    file_init,
+    file_close,
+    file_present,
+    null_set_buzzer,
+    null_set_title,
+    null_poll_exit,
+    null_key_down,
+    media_clock_us,
+    null_delay_us,
+    NULL,
+    NULL,
+    NULL
+};
@@ -0,0 +1,624 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+// chippy has its own main, SDL is only loaded at runtime
+#define SDL_MAIN_HANDLED
+#ifdef _WIN32
+#include <SDL.h>
+#include <SDL_audio.h>
+#else
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_audio.h>
+#endif
+
+#include "media.h"
+
+#define SPEAKER_FREQ 440
+#define SAMPLING_FREQ 44100
+
+#define PI2 6.283185307179586
+
+#define WINDOW_WIDTH 640
+#define WINDOW_HEIGHT 480
+
+static const float TONE_INC = (float)(PI2 *  SPEAKER_FREQ / SAMPLING_FREQ);
+
+// SDL functions used, X(return type, name without SDL_, parameters),
+// resolved from the shared library when the backend is initialized
+#define SDL_FUNCS(X) \
+    X(int, Init, (Uint32 flags)) \
+    X(void, Quit, (void)) \
+    X(const char *, GetError, (void)) \
+    X(void, Log, (const char *fmt, ...)) \
+    X(void, LogError, (int category, const char *fmt, ...)) \
+    X(void, LogInfo, (int category, const char *fmt, ...)) \
+    X(void, LogSetAllPriority, (SDL_LogPriority priority)) \
+    X(Uint64, GetPerformanceCounter, (void)) \
+    X(Uint64, GetPerformanceFrequency, (void)) \
+    X(void, Delay, (Uint32 ms)) \
+    X(SDL_AudioDeviceID, OpenAudioDevice, (const char *device, int iscapture, \
+        const SDL_AudioSpec *desired, SDL_AudioSpec *obtained, int allowed_changes)) \
+    X(void, CloseAudioDevice, (SDL_AudioDeviceID dev)) \
+    X(void, PauseAudioDevice, (SDL_AudioDeviceID dev, int pause_on)) \
+    X(SDL_Window *, CreateWindow, (const char *title, int x, int y, int w, int h, Uint32 flags)) \
+    X(void, DestroyWindow, (SDL_Window *window)) \
+    X(void, SetWindowMinimumSize, (SDL_Window *window, int w, int h)) \
+    X(void, SetWindowSize, (SDL_Window *window, int w, int h)) \
+    X(void, SetWindowTitle, (SDL_Window *window, const char *title)) \
+    X(SDL_Renderer *, CreateRenderer, (SDL_Window *window, int index, Uint32 flags)) \
+    X(void, DestroyRenderer, (SDL_Renderer *renderer)) \
+    X(int, RenderSetLogicalSize, (SDL_Renderer *renderer, int w, int h)) \
+    X(int, RenderSetIntegerScale, (SDL_Renderer *renderer, SDL_bool enable)) \
+    X(int, RenderClear, (SDL_Renderer *renderer)) \
+    X(int, RenderCopy, (SDL_Renderer *renderer, SDL_Texture *texture, \
+        const SDL_Rect *srcrect, const SDL_Rect *dstrect)) \
+    X(void, RenderPresent, (SDL_Renderer *renderer)) \
+    X(SDL_Texture *, CreateTexture, (SDL_Renderer *renderer, Uint32 format, int access, int w, int h)) \
+    X(void, DestroyTexture, (SDL_Texture *texture)) \
+    X(int, UpdateTexture, (SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch)) \
+    X(int, PollEvent, (SDL_Event *event)) \
+    X(void, PumpEvents, (void)) \
+    X(const Uint8 *, GetKeyboardState, (int *numkeys))
+
+static struct
+{
+    void *lib;
+#define SDL_FUNC_PTR(ret, name, params) ret (*name) params;
+    SDL_FUNCS(SDL_FUNC_PTR)
+#undef SDL_FUNC_PTR
+} sdl;
+
+#ifdef _WIN32
+#include <windows.h>
+
+static const char *const lib_names[] = { "SDL2.dll", NULL };
+
+static void *lib_open(const char *name)
+{
+    return (void *)LoadLibraryA(name);
+}
+
+static void *lib_symbol(void *lib, const char *name)
+{
+    return (void *)GetProcAddress((HMODULE)lib, name);
+}
+
+static void lib_close(void *lib)
+{
+    FreeLibrary((HMODULE)lib);
+}
+#else
+#include <dlfcn.h>
+
+static const char *const lib_names[] = {
+    "libSDL2-2.0.so.0", "libSDL2.so", "libSDL2-2.0.0.dylib", "libSDL2.dylib", NULL
+};
+
+static void *lib_open(const char *name)
+{
+    return dlopen(name, RTLD_NOW | RTLD_LOCAL);
+}
+
+static void *lib_symbol(void *lib, const char *name)
+{
+    return dlsym(lib, name);
+}
+
+static void lib_close(void *lib)
+{
+    dlclose(lib);
+}
+#endif
+
+static int load_sdl(void)
+{
+    if (sdl.lib != NULL)
+        return 0;
+    for (int i = 0; lib_names[i] != NULL && sdl.lib == NULL; i++)
+        sdl.lib = lib_open(lib_names[i]);
+    if (sdl.lib == NULL)
+    {
+        printf("Failed to load SDL2, use --media term, null or file without it\n");
+        return 1;
+    }
+
+    // the usual way to store a symbol in a function pointer
+#define SDL_FUNC_LOAD(ret, name, params) \
+    if ((*(void **)&sdl.name = lib_symbol(sdl.lib, "SDL_" #name)) == NULL) \
+    { \
+        printf("SDL2 has no SDL_" #name "\n"); \
+        lib_close(sdl.lib); \
+        sdl.lib = NULL; \
+        return 1; \
+    }
+    SDL_FUNCS(SDL_FUNC_LOAD)
+#undef SDL_FUNC_LOAD
+    return 0;
+}
+
+struct sdl_audio
+{
+    float last_tone;
+    int playing;
+    uint32_t buffer_us; // duration of one audio buffer
+    struct media_stats *stats;
+    SDL_AudioSpec audio_spec;
+    SDL_AudioDeviceID audio_dev;
+};
+
+struct sdl_graphics
+{
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    unsigned int pixels[TEXTURE_WIDTH * TEXTURE_HEIGHT * 4];
+    // display in the texture, only rows that differ from it are uploaded
+    uint8_t shown[MEDIA_DISP_SIZE];
+    int shown_valid; // 0 before the first frame and after the overlay
+};
+
+// Spectator wall, the displays of many cpus are tiles of one atlas
+// texture, only tiles whose display changed are uploaded
+struct sdl_wall
+{
+    SDL_Texture* texture;
+    int count;
+    int cols;
+    int rows;
+    uint32_t uploads; // tiles uploaded since the last render
+    uint8_t last[MEDIA_WALL_MAX][MEDIA_DISP_SIZE]; // display shown by each tile
+    unsigned int tile[TEXTURE_WIDTH * TEXTURE_HEIGHT];
+};
+
+static struct sdl_audio audio;
+static struct sdl_graphics graphics;
+static struct sdl_wall wall;
+
+static uint64_t us_now(void)
+{
+    uint64_t counter = sdl.GetPerformanceCounter();
+    uint64_t freq = sdl.GetPerformanceFrequency();
+    return (counter / freq) * 1000000 + (counter % freq) * 1000000 / freq;
+}
+
+static void audio_callback(void* user_data, uint8_t* stream, int len)
+{
+    struct sdl_audio *sa = (struct sdl_audio*)user_data;
+    struct media_stats *ms = sa->stats;
+    uint64_t start = us_now();
+
+    // the device drained its buffer before we were asked to refill it,
+    // callbacks come about a buffer apart so allow for scheduling jitter
+    if (ms->audio_last_us != 0 && start - ms->audio_last_us > sa->buffer_us * 3 / 2)
+        ms->audio_underruns++;
+
+    for (int i = 0; i < len; i++)
+    {
+        stream[i] = (uint8_t) (sinf(sa->last_tone) + 127);
+        sa->last_tone += TONE_INC;
+    }
+
+    uint32_t took = (uint32_t)(us_now() - start);
+    ms->audio_callbacks++;
+    ms->audio_callback_us += took;
+    if (took > ms->audio_callback_max_us)
+        ms->audio_callback_max_us = took;
+    ms->audio_last_us = start;
+}
+
+static int init_audio(struct sdl_audio *sa, struct media_stats *stats)
+{
+    sa->last_tone = 0;
+    sa->playing = 0;
+    sa->stats = stats;
+
+    sa->audio_spec.freq = SAMPLING_FREQ; // number of samples per second
+    sa->audio_spec.format = AUDIO_U8; // sample type (here: unsigned 8 bit)
+    sa->audio_spec.channels = 1; // only one channel
+    sa->audio_spec.samples = 4096; // buffer-size
+    sa->audio_spec.callback = audio_callback; // function SDL calls periodically to refill the buffer
+    sa->audio_spec.userdata = sa; // tone counter and stats
+    SDL_AudioSpec have;
+
+    sa->audio_dev = sdl.OpenAudioDevice(NULL, 0, &sa->audio_spec, &have, 0);
+
+    if (sa->audio_dev == 0)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_AUDIO, "Failed to open audio: %s", sdl.GetError());
+        return 1;
+    }
+
+    if (sa->audio_spec.format != have.format)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_AUDIO, "Failed to get the desired audio spec");
+        return 1;
+    }
+    sa->buffer_us = (uint32_t)((uint64_t)have.samples * 1000000 / have.freq);
+    return 0;
+}
+
+static void close_sound(struct sdl_audio *sa)
+{
+    if(sa->audio_dev != 0)
+        sdl.CloseAudioDevice(sa->audio_dev);
+    sa->audio_dev = 0;
+}
+
+static int init_graphics(struct sdl_graphics *sg)
+{
+    sg->window = sdl.CreateWindow("Chippy",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        WINDOW_WIDTH, WINDOW_HEIGHT,
+        SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL);
+
+    if(sg->window == NULL)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create window: %s", sdl.GetError());
+        return 1;
+    }
+
+    sdl.SetWindowMinimumSize(sg->window, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+
+    sg->renderer = sdl.CreateRenderer(sg->window, -1, SDL_RENDERER_PRESENTVSYNC);
+
+    if(sg->renderer == NULL)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create renderer: %s", sdl.GetError());
+        return 1;
+    }
+
+    if(sdl.RenderSetLogicalSize(sg->renderer, TEXTURE_WIDTH, TEXTURE_HEIGHT) != 0)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to set logical size: %s", sdl.GetError());
+        return 1;
+    }
+
+    if(sdl.RenderSetIntegerScale(sg->renderer, 1) != 0)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to set scaling: %s", sdl.GetError());
+        return 1;
+    }
+
+    sg->texture = sdl.CreateTexture(sg->renderer,
+        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+        TEXTURE_WIDTH, TEXTURE_HEIGHT);
+
+    if(sg->texture == NULL)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create texture: %s", sdl.GetError());
+        return 1;
+    }
+    // streaming textures start undefined
+    sg->shown_valid = 0;
+
+    return 0;
+}
+
+static void close_wall(struct sdl_wall *sw)
+{
+    if (sw->texture != NULL)
+        sdl.DestroyTexture(sw->texture);
+    sw->texture = NULL;
+}
+
+static void close_graphics(struct sdl_graphics *sg)
+{
+    if (sg->texture != NULL)
+        sdl.DestroyTexture(sg->texture);
+    sg->texture = NULL;
+
+    if (sg->renderer != NULL)
+        sdl.DestroyRenderer(sg->renderer);
+    sg->renderer = NULL;
+
+    if (sg->window != NULL)
+        sdl.DestroyWindow(sg->window);
+    sg->window = NULL;
+}
+
+static int sdl_init(struct chip8_media *media)
+{
+    if (load_sdl() != 0)
+        return 1;
+
+    if (sdl.Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO) != 0)
+    {
+        sdl.Log("Failed to initialize SDL: %s", sdl.GetError());
+        return 1;
+    }
+
+    sdl.LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
+    sdl.LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Initializing media");
+
+    wall.texture = NULL;
+    wall.count = 0;
+
+    if (init_audio(&audio, &media->stats) != 0)
+        return 1;
+
+    if (init_graphics(&graphics) != 0)
+        return 1;
+    return 0;
+}
+
+static void sdl_close(struct chip8_media *media)
+{
+    (void)media;
+    close_sound(&audio);
+    close_wall(&wall);
+    close_graphics(&graphics);
+
+    sdl.Quit();
+}
+
+// white on dark grey, XO-CHIP plane 1 in orange, both planes in blue
+static const unsigned int palette[4] = { 0x333333ff, 0xffffffff, 0xff8800ff, 0x3399ffff };
+
+// Draws texture row y, lores pixels are scale x scale texels
+static void draw_row(unsigned int *px, const uint8_t *disp, int y, int scale)
+{
+    for (int x = 0; x < TEXTURE_WIDTH; x++)
+        px[x] = palette[display_pixel(disp, x / scale, y / scale)];
+}
+
+static int row_changed(const uint8_t *disp, const uint8_t *shown, int row)
+{
+    size_t at = 1 + (size_t)row * DISPLAY_ROW_BYTES;
+    return memcmp(disp + at, shown + at, DISPLAY_ROW_BYTES) != 0 ||
+        memcmp(disp + at + DISPLAY_PLANE_SIZE, shown + at + DISPLAY_PLANE_SIZE, DISPLAY_ROW_BYTES) != 0;
+}
+
+static void set_pixel_dbg(int x, int y, int active)
+{
+    if(active)
+        graphics.pixels[x + y * TEXTURE_WIDTH] = 0x00ff002f;
+    else
+        graphics.pixels[x + y * TEXTURE_WIDTH] = 0xff00002f;
+}
+
+static void draw_frame_graph(const struct media_graph *graph)
+{
+    int count = graph->count;
+    int pos = graph->pos;
+
+    // newest frame in the rightmost column
+    for (int x = TEXTURE_WIDTH - 1; x >= 0 && count > 0; x--, count--)
+    {
+        pos = (pos + STATS_HISTORY - 1) % STATS_HISTORY;
+        uint32_t height = graph->frame_us[pos] * 8 / graph->budget_us + 1;
+        if (height > TEXTURE_HEIGHT)
+            height = TEXTURE_HEIGHT;
+        for (uint32_t y = 0; y < height; y++)
+            set_pixel_dbg(x, TEXTURE_HEIGHT - 1 - y, graph->frame_us[pos] <= graph->budget_us);
+    }
+}
+
+static void sdl_present(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph)
+{
+    struct sdl_graphics *sg = &graphics;
+    (void)media;
+
+    // redraw the changed rows, upload the band from the first to the last
+    int scale = TEXTURE_WIDTH / display_width(disp);
+    int all = !sg->shown_valid || graph != NULL || disp[0] != sg->shown[0];
+    int first = -1;
+    int end = 0;
+    for (int row = 0; row < display_height(disp); row++)
+    {
+        if (!all && !row_changed(disp, sg->shown, row))
+            continue;
+        for (int y = row * scale; y < (row + 1) * scale; y++)
+            draw_row(sg->pixels + y * TEXTURE_WIDTH, disp, y, scale);
+        if (first < 0)
+            first = row * scale;
+        end = (row + 1) * scale;
+    }
+    memcpy(sg->shown, disp, MEDIA_DISP_SIZE);
+    // the graph is drawn over the display, the next frame redraws it all
+    sg->shown_valid = graph == NULL;
+
+    if (graph != NULL)
+        draw_frame_graph(graph);
+
+    if (first >= 0)
+    {
+        SDL_Rect rect;
+        rect.x = 0;
+        rect.y = first;
+        rect.w = TEXTURE_WIDTH;
+        rect.h = end - first;
+        sdl.UpdateTexture(sg->texture, &rect, sg->pixels + first * TEXTURE_WIDTH, TEXTURE_WIDTH * 4);
+    }
+    sdl.RenderClear(sg->renderer);
+    sdl.RenderCopy(sg->renderer, sg->texture, NULL, NULL);
+    sdl.RenderPresent(sg->renderer);
+}
+
+static void sdl_set_title(struct chip8_media *media, const char *title)
+{
+    (void)media;
+    sdl.SetWindowTitle(graphics.window, title);
+}
+
+static void sdl_set_buzzer(struct chip8_media *media, int active)
+{
+    if (active == audio.playing)
+        return;
+    audio.playing = active;
+
+    if (active)
+    {
+        // the callback didn't run while paused, that's no underrun
+        media->stats.audio_last_us = 0;
+        sdl.PauseAudioDevice(audio.audio_dev, 0);
+    }
+    else
+        sdl.PauseAudioDevice(audio.audio_dev, 1);
+}
+
+// Copies the tile buffer into tile index of the texture
+static void wall_put(struct sdl_wall *sw, int index)
+{
+    SDL_Rect rect;
+    rect.x = index % sw->cols * TEXTURE_WIDTH;
+    rect.y = index / sw->cols * TEXTURE_HEIGHT;
+    rect.w = TEXTURE_WIDTH;
+    rect.h = TEXTURE_HEIGHT;
+    sdl.UpdateTexture(sw->texture, &rect, sw->tile, TEXTURE_WIDTH * 4);
+}
+
+static void wall_upload(struct sdl_wall *sw, int index, const uint8_t *disp)
+{
+    int scale = TEXTURE_WIDTH / display_width(disp);
+    for (int y = 0; y < TEXTURE_HEIGHT; y++)
+        draw_row(sw->tile + y * TEXTURE_WIDTH, disp, y, scale);
+
+    wall_put(sw, index);
+    memcpy(sw->last[index], disp, MEDIA_DISP_SIZE);
+    sw->uploads++;
+}
+
+static int sdl_wall_init(struct chip8_media *media, int count)
+{
+    struct sdl_wall *sw = &wall;
+    struct sdl_graphics *sg = &graphics;
+    (void)media;
+
+    if (count < 1 || count > MEDIA_WALL_MAX)
+        return 1;
+
+    // about square, tiles are twice as wide as high
+    sw->cols = 1;
+    while (sw->cols * sw->cols * 2 < count)
+        sw->cols++;
+    sw->rows = (count + sw->cols - 1) / sw->cols;
+    sw->count = count;
+
+    int width = sw->cols * TEXTURE_WIDTH;
+    int height = sw->rows * TEXTURE_HEIGHT;
+    sw->texture = sdl.CreateTexture(sg->renderer,
+        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+        width, height);
+
+    if (sw->texture == NULL)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to create wall texture: %s", sdl.GetError());
+        return 1;
+    }
+
+    // the wall may be larger than the window, scale it down
+    if (sdl.RenderSetIntegerScale(sg->renderer, 0) != 0 ||
+        sdl.RenderSetLogicalSize(sg->renderer, width, height) != 0)
+    {
+        sdl.LogError(SDL_LOG_CATEGORY_RENDER, "Failed to set wall size: %s", sdl.GetError());
+        return 1;
+    }
+    sdl.SetWindowMinimumSize(sg->window, sw->cols * 2, sw->rows);
+    if (width < WINDOW_WIDTH)
+        sdl.SetWindowSize(sg->window, WINDOW_WIDTH, WINDOW_WIDTH * height / width);
+    else
+        sdl.SetWindowSize(sg->window, width, height);
+
+    // streaming textures start undefined, upload every tile once, the
+    // grid can have more tiles than sessions (only those have a last)
+    static const uint8_t blank[MEDIA_DISP_SIZE];
+    for (int i = 0; i < count; i++)
+        wall_upload(sw, i, blank);
+    for (int i = count; i < sw->cols * sw->rows; i++)
+        wall_put(sw, i);
+    return 0;
+}
+
+static void sdl_wall_update(struct chip8_media *media, int index, const uint8_t *disp)
+{
+    struct sdl_wall *sw = &wall;
+    (void)media;
+    if (index < 0 || index >= sw->count)
+        return;
+    if (memcmp(sw->last[index], disp, MEDIA_DISP_SIZE) != 0)
+        wall_upload(sw, index, disp);
+}
+
+static void sdl_wall_render(struct chip8_media *media)
+{
+    (void)media;
+    sdl.RenderClear(graphics.renderer);
+    sdl.RenderCopy(graphics.renderer, wall.texture, NULL, NULL);
+    sdl.RenderPresent(graphics.renderer);
+    wall.uploads = 0;
+}
+
+static int sdl_poll_exit(struct chip8_media *media)
+{
+    SDL_Event ev;
+    (void)media;
+    while (sdl.PollEvent(&ev))
+    {
+        if (ev.type == SDL_QUIT)
+            return 1;
+    }
+    return 0;
+}
+
+static const int chip8_to_sdl_keymap[] =
+{
+    SDL_SCANCODE_X, // 0
+    SDL_SCANCODE_1, // 1
+    SDL_SCANCODE_2, // 2
+    SDL_SCANCODE_3, // 3
+    SDL_SCANCODE_Q, // 4
+    SDL_SCANCODE_W, // 5
+    SDL_SCANCODE_E, // 6
+    SDL_SCANCODE_A, // 7
+    SDL_SCANCODE_S, // 8
+    SDL_SCANCODE_D, // 9
+    SDL_SCANCODE_Y, // A
+    SDL_SCANCODE_C, // B
+    SDL_SCANCODE_4, // C
+    SDL_SCANCODE_R, // D
+    SDL_SCANCODE_F, // E
+    SDL_SCANCODE_V  // F
+};
+
+static int sdl_key_down(struct chip8_media *media, uint8_t chip8_key)
+{
+    const Uint8* sdl_keystate;
+    (void)media;
+
+    if (chip8_key > 15) return 0;
+    sdl.PumpEvents(); // required?
+    sdl_keystate = sdl.GetKeyboardState(NULL);
+    int sdl_key = chip8_to_sdl_keymap[chip8_key];
+
+    return sdl_keystate[sdl_key];
+}
+
+static uint64_t sdl_us_elapsed(struct chip8_media *media)
+{
+    (void)media;
+    return us_now();
+}
+
+static void sdl_delay_us(struct chip8_media *media, uint32_t us)
+{
+    (void)media;
+    sdl.Delay(us / 1000);
+}
+
+const struct media_backend media_sdl =
+{
+    "sdl",
+    sdl_init,
+    sdl_close,
+    sdl_present,
+    sdl_set_buzzer,
+    sdl_set_title,
+    sdl_poll_exit,
+    sdl_key_down,
+    sdl_us_elapsed,
+    sdl_delay_us,
+    sdl_wall_init,
+    sdl_wall_update,
+    sdl_wall_render
+};
@@ -0,0 +1,120 @@
+#include <string.h>
+#include "profile.h"
+
+#define NO_NODE 0xffff
+#define HOT_PCS 32
+
+void profile_init(struct chip8_profile *prof)
+{
+    memset(prof, 0, sizeof(*prof));
+    // node 0 is the root, i.e. code not reached through CALL
+    prof->nodes[0].addr = 0x200;
+    prof->nodes[0].parent = NO_NODE;
+    prof->nodes[0].first_child = NO_NODE;
+    prof->nodes[0].next_sibling = NO_NODE;
+    prof->node_count = 1;
+}
+
+void profile_call(struct chip8_profile *prof, uint16_t addr)
+{
+    if(prof->depth_overflow > 0 || prof->node_count == PROFILE_MAX_NODES)
+    {
+        // attribute deeper calls to the current node until we are back
+        prof->depth_overflow++;
+        prof->dropped_calls++;
+        return;
+    }
+
+    struct profile_node *cur = &prof->nodes[prof->cur];
+    uint16_t child = cur->first_child;
+    while(child != NO_NODE && prof->nodes[child].addr != addr)
+        child = prof->nodes[child].next_sibling;
+
+    if(child == NO_NODE)
+    {
+        child = prof->node_count++;
+        struct profile_node *n = &prof->nodes[child];
+        n->addr = addr;
+        n->parent = prof->cur;
+        n->first_child = NO_NODE;
+        n->next_sibling = cur->first_child;
+        n->count = 0;
+        cur->first_child = child;
+    }
+    prof->cur = child;
+}
+
+void profile_ret(struct chip8_profile *prof)
+{
+    if(prof->depth_overflow > 0)
+        prof->depth_overflow--;
+    else if(prof->nodes[prof->cur].parent != NO_NODE)
+        prof->cur = prof->nodes[prof->cur].parent;
+}
+
+void profile_dump_flat(struct chip8_profile *prof, FILE *out)
+{
+    uint64_t total = 0;
+    for(int i=0; i<INSTR_COUNT; i++)
+        total += prof->instr_count[i];
+    if(total == 0) total = 1;
+
+    fprintf(out, "# instructions by handler\n");
+    fprintf(out, "%12s %7s  %s\n", "count", "%", "handler");
+    for(int i=0; i<INSTR_COUNT; i++)
+    {
+        if(prof->instr_count[i] == 0) continue;
+        fprintf(out, "%12llu %6.2f%%  %s\n",
+            (unsigned long long)prof->instr_count[i],
+            100.0 * prof->instr_count[i] / total,
+            instr_mnemonic(i));
+    }
+
+    // selection of the hottest addresses, the table is small enough
+    uint8_t taken[4096] = {0};
+    fprintf(out, "\n# hottest addresses\n");
+    fprintf(out, "%12s %7s  %s\n", "count", "%", "pc");
+    for(int n=0; n<HOT_PCS; n++)
+    {
+        int best = -1;
+        for(int pc=0; pc<4096; pc++)
+        {
+            if(taken[pc] || prof->pc_count[pc] == 0) continue;
+            if(best < 0 || prof->pc_count[pc] > prof->pc_count[best])
+                best = pc;
+        }
+        if(best < 0) break;
+        taken[best] = 1;
+        fprintf(out, "%12llu %6.2f%%  0x%03X\n",
+            (unsigned long long)prof->pc_count[best],
+            100.0 * prof->pc_count[best] / total,
+            best);
+    }
+
+    fprintf(out, "\n# counters\n");
+    fprintf(out, "drw_rows %llu\n", (unsigned long long)prof->drw_rows);
+    fprintf(out, "drw_collisions %llu\n", (unsigned long long)prof->drw_collisions);
+    fprintf(out, "skips_taken %llu\n", (unsigned long long)prof->skips_taken);
+    fprintf(out, "skips_not_taken %llu\n", (unsigned long long)prof->skips_not_taken);
+    fprintf(out, "dropped_calls %llu\n", (unsigned long long)prof->dropped_calls);
+}
+
+static void dump_folded_path(struct chip8_profile *prof, uint16_t node, FILE *out)
+{
+    if(prof->nodes[node].parent != NO_NODE)
+    {
+        dump_folded_path(prof, prof->nodes[node].parent, out);
+        fputc(';', out);
+    }
+    fprintf(out, "0x%03X", prof->nodes[node].addr);
+}
+
+void profile_dump_folded(struct chip8_profile *prof, FILE *out)
+{
+    for(uint16_t i=0; i<prof->node_count; i++)
+    {
+        if(prof->nodes[i].count == 0) continue;
+        dump_folded_path(prof, i, out);
+        fprintf(out, " %llu\n", (unsigned long long)prof->nodes[i].count);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef CHIPPY_PROFILE_H
+#define CHIPPY_PROFILE_H
+
+// Guest execution profiler, only compiled in with -DCHIPPY_PROFILE
+// (zig build -Dprofile=true). Without it all PROFILE_* hooks vanish.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "instr.h"
+
+#define PROFILE_MAX_NODES 1024
+
+// Node in the CALL/RET tree, addr is the subroutine entry point
+struct profile_node
+{
+    uint16_t addr;
+    uint16_t parent;
+    uint16_t first_child;
+    uint16_t next_sibling;
+    uint64_t count; // instructions executed directly in this node
+};
+
+struct chip8_profile
+{
+    uint64_t instr_count[INSTR_COUNT]; // executions per handler
+    uint64_t pc_count[4096]; // executions per address
+    uint64_t drw_rows;
+    uint64_t drw_collisions;
+    uint64_t skips_taken;
+    uint64_t skips_not_taken;
+    uint64_t dropped_calls; // calls that didn't fit into nodes
+    uint16_t cur; // current node
+    uint16_t depth_overflow; // calls nested below a dropped call
+    uint16_t node_count;
+    struct profile_node nodes[PROFILE_MAX_NODES];
+};
+
+void profile_init(struct chip8_profile *prof);
+
+void profile_call(struct chip8_profile *prof, uint16_t addr);
+
+void profile_ret(struct chip8_profile *prof);
+
+// Flat profile: handlers, hot PCs and DRW/skip counters
+void profile_dump_flat(struct chip8_profile *prof, FILE *out);
+
+// One line per call path, "0x200;0x2a4;0x31c count", for flamegraph.pl
+void profile_dump_folded(struct chip8_profile *prof, FILE *out);
+
+#ifdef CHIPPY_PROFILE
+
+static inline void profile_instr(struct chip8_profile *prof, int id, uint16_t pc)
+{
+    prof->instr_count[id]++;
+    prof->pc_count[pc & 0xfff]++;
+    prof->nodes[prof->cur].count++;
+}
+
+#define PROFILE_INSTR(cpu, id, pc) \
+    do { if((cpu)->profile) profile_instr((cpu)->profile, (id), (pc)); } while(0)
+#define PROFILE_SKIP(cpu, taken) \
+    do { if((cpu)->profile) { if(taken) (cpu)->profile->skips_taken++; \
+        else (cpu)->profile->skips_not_taken++; } } while(0)
+#define PROFILE_DRW(cpu, rows, collision) \
+    do { if((cpu)->profile) { (cpu)->profile->drw_rows += (rows); \
+        (cpu)->profile->drw_collisions += (collision); } } while(0)
+#define PROFILE_CALL(cpu, addr) \
+    do { if((cpu)->profile) profile_call((cpu)->profile, (addr)); } while(0)
+#define PROFILE_RET(cpu) \
+    do { if((cpu)->profile) profile_ret((cpu)->profile); } while(0)
+
+#else
+
+#define PROFILE_INSTR(cpu, id, pc) ((void)0)
+#define PROFILE_SKIP(cpu, taken) ((void)0)
+#define PROFILE_DRW(cpu, rows, collision) ((void)0)
+#define PROFILE_CALL(cpu, addr) ((void)0)
+#define PROFILE_RET(cpu) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+#include "quirks.h"
+
+static const char *const quirks_names[QUIRKS_COUNT] =
+{
+    "legacy",
+    "vip",
+    "chip48",
+    "schip",
+    "modern"
+};
+
+const char *quirks_name(enum quirks quirks)
+{
+    if(quirks >= QUIRKS_COUNT) return "?";
+    return quirks_names[quirks];
+}
+
+int quirks_parse(const char *name)
+{
+    for(int i=0; i<QUIRKS_COUNT; i++)
+    {
+        if(strcmp(name, quirks_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+uint64_t quirks_rom_hash(const uint8_t *rom, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i=0; i<len; i++)
+    {
+        hash ^= rom[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int quirks_lookup(const char *db_path, uint64_t hash)
+{
+    char line[256];
+    char name[32];
+    unsigned long long entry;
+    int result = -1;
+
+    FILE *fs = fopen(db_path, "r");
+    if(fs == NULL)
+        return -1;
+
+    while(result < 0 && fgets(line, sizeof(line), fs) != NULL)
+    {
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "%llx %31s", &entry, name) == 2 && entry == hash)
+            result = quirks_parse(name);
+    }
+    fclose(fs);
+    return result;
+}
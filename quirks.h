@@ -0,0 +1,24 @@
+#ifndef CHIPPY_QUIRKS_H
+#define CHIPPY_QUIRKS_H
+
+// Quirk profile names and the ROM hash database used to pick one.
+// Database lines look like "<fnv1a-64 hash in hex> <profile> [comment]",
+// '#' starts a comment line.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+const char *quirks_name(enum quirks quirks);
+
+// Returns -1 for unknown names
+int quirks_parse(const char *name);
+
+// FNV-1a 64 bit hash of the ROM contents
+uint64_t quirks_rom_hash(const uint8_t *rom, size_t len);
+
+// Looks the hash up in the database file, returns the profile or -1
+// if the file or the hash isn't there
+int quirks_lookup(const char *db_path, uint64_t hash);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stddef.h>
+#include "sched.h"
+
+void sched_init(struct sched *s, struct sched_vm *vms, uint32_t *run, uint32_t *heap, uint32_t cap)
+{
+    s->vms = vms;
+    s->count = 0;
+    s->cap = cap;
+    s->run = run;
+    s->run_count = 0;
+    s->heap = heap;
+    s->heap_count = 0;
+    s->parks = 0;
+    s->wakes = 0;
+}
+
+static void run_push(struct sched *s, uint32_t id)
+{
+    s->vms[id].state = SCHED_RUNNABLE;
+    s->vms[id].pos = s->run_count;
+    s->run[s->run_count++] = id;
+}
+
+static void run_remove(struct sched *s, uint32_t id)
+{
+    uint32_t pos = s->vms[id].pos;
+    uint32_t last = s->run[--s->run_count];
+    s->run[pos] = last;
+    s->vms[last].pos = pos;
+    s->vms[id].pos = SCHED_NONE;
+}
+
+static void heap_swap(struct sched *s, uint32_t a, uint32_t b)
+{
+    uint32_t tmp = s->heap[a];
+    s->heap[a] = s->heap[b];
+    s->heap[b] = tmp;
+    s->vms[s->heap[a]].pos = a;
+    s->vms[s->heap[b]].pos = b;
+}
+
+static uint64_t heap_key(struct sched *s, uint32_t pos)
+{
+    return s->vms[s->heap[pos]].wake_us;
+}
+
+static void heap_up(struct sched *s, uint32_t pos)
+{
+    while(pos > 0 && heap_key(s, (pos - 1) / 2) > heap_key(s, pos))
+    {
+        heap_swap(s, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void heap_push(struct sched *s, uint32_t id)
+{
+    uint32_t pos = s->heap_count++;
+    s->heap[pos] = id;
+    s->vms[id].pos = pos;
+    heap_up(s, pos);
+}
+
+static void heap_down(struct sched *s, uint32_t pos)
+{
+    for(;;)
+    {
+        uint32_t min = pos;
+        uint32_t l = 2 * pos + 1;
+        uint32_t r = l + 1;
+        if(l < s->heap_count && heap_key(s, l) < heap_key(s, min)) min = l;
+        if(r < s->heap_count && heap_key(s, r) < heap_key(s, min)) min = r;
+        if(min == pos) break;
+        heap_swap(s, pos, min);
+        pos = min;
+    }
+}
+
+static void heap_remove(struct sched *s, uint32_t id)
+{
+    uint32_t pos = s->vms[id].pos;
+    heap_swap(s, pos, --s->heap_count);
+    // the former last entry may belong above or below pos
+    if(pos < s->heap_count)
+    {
+        heap_up(s, pos);
+        heap_down(s, pos);
+    }
+    s->vms[id].pos = SCHED_NONE;
+}
+
+static uint32_t heap_pop(struct sched *s)
+{
+    uint32_t id = s->heap[0];
+    heap_remove(s, id);
+    return id;
+}
+
+uint32_t sched_add(struct sched *s, struct chip8 *cpu, uint64_t now_us)
+{
+    if(s->count == s->cap)
+        return SCHED_NONE;
+    uint32_t id = s->count++;
+    s->vms[id].cpu = cpu;
+    s->vms[id].next_tick_us = now_us + SCHED_TICK_US;
+    s->vms[id].wake_us = 0;
+    run_push(s, id);
+    return id;
+}
+
+// Lets the ticks a parked cpu missed pass, its timers follow on their own
+static void catch_up(struct sched_vm *vm, uint64_t now_us)
+{
+    if(vm->next_tick_us > now_us)
+        return;
+    uint64_t ticks = (now_us - vm->next_tick_us) / SCHED_TICK_US + 1;
+    cpu_idle(vm->cpu, ticks * vm->cpu->tick_cycles);
+    vm->next_tick_us += ticks * SCHED_TICK_US;
+}
+
+// Recognizes the delay loop "L: Fx07, 3xkk, 1L" with pc anywhere in it,
+// returns the kk the loop waits for or -1
+static int delay_loop_target(struct chip8 *cpu)
+{
+    for(int back=0; back<=4; back+=2)
+    {
+        uint16_t l = (cpu->pc - back) & (CPU_MEM_SIZE - 1);
+        if(l + 6 > CPU_MEM_SIZE)
+            continue;
+        const uint8_t *m = cpu->mem + l;
+        uint8_t x = m[0] & 0xf;
+        if((m[0] & 0xf0) == 0xf0 && m[1] == 0x07
+            && m[2] == (0x30 | x)
+            && m[4] == (0x10 | (l >> 8)) && m[5] == (l & 0xff))
+            return m[3];
+    }
+    return -1;
+}
+
+// Parks the cpu if it can't make progress on its own, returns 1 if it did
+static int try_park(struct sched *s, uint32_t id)
+{
+    struct sched_vm *vm = &s->vms[id];
+    struct chip8 *cpu = vm->cpu;
+
+    if(cpu->status != CPU_OK)
+    {
+        run_remove(s, id);
+        vm->state = SCHED_STOPPED;
+        return 1;
+    }
+    if(cpu->wait_key)
+    {
+        run_remove(s, id);
+        vm->state = SCHED_PARKED_KEY;
+        s->parks++;
+        return 1;
+    }
+    // traced, debugged or profiled cpus must execute every instruction
+    int hooked = cpu->trace != NULL || cpu->debug != NULL;
+#ifdef CHIPPY_PROFILE
+    hooked |= cpu->profile != NULL;
+#endif
+    if(hooked)
+        return 0;
+
+    int target = delay_loop_target(cpu);
+    uint8_t dt = cpu_get_dt(cpu);
+    uint8_t st = cpu_get_st(cpu);
+    if(target < 0 || dt <= target)
+        return 0;
+
+    // the tick which brings dt down to the target, or earlier if the
+    // sound timer runs out first so the buzzer stops in time
+    uint8_t ticks = dt - target;
+    if(st > 0 && st < ticks)
+        ticks = st;
+    run_remove(s, id);
+    vm->state = SCHED_PARKED_TIMER;
+    vm->wake_us = vm->next_tick_us + (uint64_t)(ticks - 1) * SCHED_TICK_US;
+    heap_push(s, id);
+    s->parks++;
+    return 1;
+}
+
+static void wake(struct sched *s, uint32_t id, uint64_t now_us)
+{
+    struct sched_vm *vm = &s->vms[id];
+    // a late timer wake idles only up to the tick where dt reaches the
+    // loop's target, the guest has to see that value; the ticks after it
+    // are run, or dropped if too many, like those of a running cpu
+    uint64_t until = now_us;
+    if(vm->state == SCHED_PARKED_TIMER && vm->wake_us < until)
+        until = vm->wake_us;
+    catch_up(vm, until);
+    run_push(s, id);
+    s->wakes++;
+}
+
+uint64_t sched_run(struct sched *s, uint64_t now_us)
+{
+    uint64_t cycles = 0;
+
+    while(s->heap_count > 0 && heap_key(s, 0) <= now_us)
+        wake(s, heap_pop(s), now_us);
+
+    for(uint32_t i=0; i<s->run_count; )
+    {
+        uint32_t id = s->run[i];
+        struct sched_vm *vm = &s->vms[id];
+        struct chip8 *cpu = vm->cpu;
+        int parked = 0;
+
+        for(int t=0; t<SCHED_MAX_CATCH_UP && vm->next_tick_us <= now_us && !parked; t++)
+        {
+            cycles += cpu_run(cpu, cpu->tick_cycles);
+            vm->next_tick_us += SCHED_TICK_US;
+            parked = try_park(s, id);
+        }
+
+        // too far behind, drop the missed ticks
+        if(!parked && vm->next_tick_us <= now_us)
+            vm->next_tick_us = now_us + SCHED_TICK_US;
+
+        // a parked cpu was swapped out of slot i
+        if(!parked)
+            i++;
+    }
+    return cycles;
+}
+
+void sched_key(struct sched *s, uint32_t id, uint8_t key, uint8_t state, uint64_t now_us)
+{
+    struct sched_vm *vm = &s->vms[id];
+    cpu_set_key_state(vm->cpu, key, state);
+    if(vm->state == SCHED_PARKED_KEY && !vm->cpu->wait_key)
+        wake(s, id, now_us);
+}
+
+void sched_wake(struct sched *s, uint32_t id, uint64_t now_us)
+{
+    struct sched_vm *vm = &s->vms[id];
+    if(vm->state == SCHED_RUNNABLE)
+        return;
+    if(vm->state == SCHED_PARKED_TIMER)
+        heap_remove(s, id);
+    wake(s, id, now_us);
+}
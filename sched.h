@@ -0,0 +1,64 @@
+#ifndef CHIPPY_SCHED_H
+#define CHIPPY_SCHED_H
+
+// Cooperative scheduler running many cpus on one thread. Every runnable
+// cpu executes one 60 Hz timer tick worth of cycles (tick_cycles) per due
+// tick. Cpus which wait for a key (Fx0A) or spin on the delay timer are
+// parked and cost nothing until a key event or their timer deadline
+// (min-heap) wakes them up, the cycles they missed are idled away on wake.
+// All storage is provided by the caller.
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define SCHED_TICK_US 16667
+#define SCHED_MAX_CATCH_UP 4 // ticks run per call for a late cpu, the rest is dropped
+#define SCHED_NONE 0xffffffffu
+
+enum sched_state
+{
+    SCHED_RUNNABLE,
+    SCHED_PARKED_KEY, // waiting in Fx0A
+    SCHED_PARKED_TIMER, // spinning until the delay timer expires
+    SCHED_STOPPED // cpu status isn't CPU_OK
+};
+
+struct sched_vm
+{
+    struct chip8 *cpu;
+    uint8_t state; // enum sched_state
+    uint64_t next_tick_us; // time of the next 60 Hz tick
+    uint64_t wake_us; // deadline while parked on the timer
+    uint32_t pos; // index in the run list or the heap
+};
+
+struct sched
+{
+    struct sched_vm *vms;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *run; // runnable vm ids
+    uint32_t run_count;
+    uint32_t *heap; // timer parked vm ids, min-heap on wake_us
+    uint32_t heap_count;
+    uint64_t parks;
+    uint64_t wakes;
+};
+
+// vms, run and heap must each hold cap entries
+void sched_init(struct sched *s, struct sched_vm *vms, uint32_t *run, uint32_t *heap, uint32_t cap);
+
+// Returns the vm id or SCHED_NONE if full
+uint32_t sched_add(struct sched *s, struct chip8 *cpu, uint64_t now_us);
+
+// Runs all due ticks of all runnable cpus and wakes expired timers.
+// Returns the number of executed cycles.
+uint64_t sched_run(struct sched *s, uint64_t now_us);
+
+// Forwards a key state to the cpu and wakes it if it waited for a key
+void sched_key(struct sched *s, uint32_t id, uint8_t key, uint8_t state, uint64_t now_us);
+
+// Makes a parked or stopped cpu runnable again, e.g. after a reset
+void sched_wake(struct sched *s, uint32_t id, uint64_t now_us);
+
+#endif
@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include "shm.h"
+#include "cpu.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static int map(struct chip8_shm *shm, const char *name, int create)
+{
+    memset(shm, 0, sizeof(*shm));
+    if(strlen(name) >= sizeof(shm->name))
+        return 1;
+    strcpy(shm->name, name);
+
+    int fd = shm_open(name, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    if(fd < 0)
+        return 1;
+    if(create && ftruncate(fd, sizeof(struct shm_layout)) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return 1;
+    }
+    void *mem = mmap(NULL, sizeof(struct shm_layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        if(create)
+            shm_unlink(name);
+        return 1;
+    }
+    shm->mem = mem;
+    shm->owner = create;
+    return 0;
+}
+
+int shm_create(struct chip8_shm *shm, const char *name)
+{
+    if(map(shm, name, 1) != 0)
+        return 1;
+    // the object starts zeroed, consumers check magic last
+    shm->mem->version = SHM_VERSION;
+    __atomic_store_n(&shm->mem->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int shm_attach(struct chip8_shm *shm, const char *name)
+{
+    if(map(shm, name, 0) != 0)
+        return 1;
+    if(__atomic_load_n(&shm->mem->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+        || shm->mem->version != SHM_VERSION)
+    {
+        shm_close(shm);
+        return 1;
+    }
+    return 0;
+}
+
+void shm_close(struct chip8_shm *shm)
+{
+    if(shm->mem == NULL)
+        return;
+    munmap(shm->mem, sizeof(struct shm_layout));
+    shm->mem = NULL;
+    if(shm->owner)
+        shm_unlink(shm->name);
+}
+
+void shm_publish(struct chip8_shm *shm, const struct chip8 *cpu)
+{
+    uint64_t frame = ++shm->frame;
+    struct shm_frame *f = &shm->mem->frames[frame % SHM_RING];
+    uint32_t seq = f->seq;
+
+    __atomic_store_n(&f->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    f->status = cpu->status;
+    f->frame = frame;
+    display_pack(&cpu->disp, f->disp);
+    memcpy(f->v, cpu->v, sizeof(f->v));
+    memcpy(f->stack, cpu->stack, sizeof(f->stack));
+    f->i = cpu->i;
+    f->pc = cpu->pc;
+    f->dt = cpu_get_dt(cpu);
+    f->st = cpu_get_st(cpu);
+    f->sp = cpu->sp;
+    f->wait_key = cpu->wait_key;
+
+    __atomic_store_n(&f->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->mem->head, frame, __ATOMIC_RELEASE);
+}
+
+int shm_poll(struct chip8_shm *shm)
+{
+    struct shm_layout *m = shm->mem;
+    uint32_t tail = m->cmd_tail;
+    int reset = 0;
+
+    for(;;)
+    {
+        uint32_t *slot = &m->cmds[tail % SHM_CMDS];
+        uint32_t cmd = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if(cmd == 0)
+            break;
+        uint8_t key = (cmd >> 8) & 0xf;
+        switch(cmd >> 16)
+        {
+            case SHM_CMD_KEY:
+                if(cmd & 0xff)
+                    shm->keys |= (uint16_t)(1 << key);
+                else
+                    shm->keys &= (uint16_t)~(1 << key);
+                break;
+            case SHM_CMD_RESET:
+                reset = 1;
+                break;
+        }
+        __atomic_store_n(slot, 0, __ATOMIC_RELAXED);
+        tail++;
+        // frees the slot for senders
+        __atomic_store_n(&m->cmd_tail, tail, __ATOMIC_RELEASE);
+    }
+    return reset;
+}
+
+const struct shm_frame *shm_latest(const struct chip8_shm *shm, uint32_t *seq)
+{
+    uint64_t head = __atomic_load_n(&shm->mem->head, __ATOMIC_ACQUIRE);
+    if(head == 0)
+        return NULL;
+    const struct shm_frame *f = &shm->mem->frames[head % SHM_RING];
+    *seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+    return f;
+}
+
+int shm_valid(const struct shm_frame *frame, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seq & 1) == 0 && __atomic_load_n(&frame->seq, __ATOMIC_RELAXED) == seq;
+}
+
+int shm_send(struct chip8_shm *shm, uint32_t cmd)
+{
+    struct shm_layout *m = shm->mem;
+    uint32_t head = __atomic_load_n(&m->cmd_head, __ATOMIC_RELAXED);
+
+    do
+    {
+        if(head - __atomic_load_n(&m->cmd_tail, __ATOMIC_ACQUIRE) >= SHM_CMDS)
+            return 1;
+    } while(!__atomic_compare_exchange_n(&m->cmd_head, &head, head + 1, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    __atomic_store_n(&m->cmds[head % SHM_CMDS], cmd, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#else
+
+int shm_create(struct chip8_shm *shm, const char *name)
+{
+    (void)name;
+    memset(shm, 0, sizeof(*shm));
+    return 1;
+}
+
+int shm_attach(struct chip8_shm *shm, const char *name)
+{
+    return shm_create(shm, name);
+}
+
+void shm_close(struct chip8_shm *shm)
+{
+    (void)shm;
+}
+
+void shm_publish(struct chip8_shm *shm, const struct chip8 *cpu)
+{
+    (void)shm;
+    (void)cpu;
+}
+
+int shm_poll(struct chip8_shm *shm)
+{
+    (void)shm;
+    return 0;
+}
+
+const struct shm_frame *shm_latest(const struct chip8_shm *shm, uint32_t *seq)
+{
+    (void)shm;
+    (void)seq;
+    return NULL;
+}
+
+int shm_valid(const struct shm_frame *frame, uint32_t seq)
+{
+    (void)frame;
+    (void)seq;
+    return 0;
+}
+
+int shm_send(struct chip8_shm *shm, uint32_t cmd)
+{
+    (void)shm;
+    (void)cmd;
+    return 1;
+}
+
+#endif
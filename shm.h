@@ -0,0 +1,91 @@
+#ifndef CHIPPY_SHM_H
+#define CHIPPY_SHM_H
+
+// Publishes the cpu state of every frame into a POSIX shared memory
+// object so other processes can read it without copies or syscalls.
+//
+// Frames go into a ring of slots, each guarded by a sequence lock: the
+// writer makes seq odd, writes the slot and makes it even again, then
+// stores the frame number in head. A reader takes the slot of head, reads
+// seq, reads the data in place and accepts it if seq didn't change and
+// is even.
+//
+// Commands (keys and reset) go the other way through a bounded lock-free
+// queue, any number of processes may send, chippy consumes them once per
+// frame. A slot holds 0 while free.
+
+#include <stdint.h>
+#include "display.h"
+
+#define SHM_MAGIC 0x53384843 // "CH8S"
+#define SHM_VERSION 2
+#define SHM_RING 8
+#define SHM_CMDS 64
+
+#define SHM_CMD_KEY 1 // key, state
+#define SHM_CMD_RESET 2
+
+#define SHM_CMD(type, key, state) ((uint32_t)(type) << 16 | (uint32_t)(key) << 8 | (uint32_t)(state))
+
+struct shm_frame
+{
+    uint32_t seq; // odd while the slot is written
+    uint32_t status; // enum cpu_status
+    uint64_t frame;
+    uint8_t disp[DISPLAY_FRAME_SIZE]; // packed, see display.h
+    uint8_t v[16];
+    uint16_t stack[16];
+    uint16_t i;
+    uint16_t pc;
+    uint8_t dt;
+    uint8_t st;
+    uint8_t sp;
+    uint8_t wait_key;
+};
+
+struct shm_layout
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t head; // number of the newest complete frame, 0 before the first
+    struct shm_frame frames[SHM_RING]; // frame n is in slot n % SHM_RING
+    uint32_t cmd_head; // next slot senders claim
+    uint32_t cmd_tail; // next slot chippy reads
+    uint32_t cmds[SHM_CMDS];
+};
+
+struct chip8;
+
+struct chip8_shm
+{
+    struct shm_layout *mem;
+    char name[64];
+    int owner; // created the object and unlinks it on close
+    uint64_t frame;
+    uint16_t keys; // keys held through commands
+};
+
+// Creates the shared memory object, name like "/chippy". Returns 0 on success.
+int shm_create(struct chip8_shm *shm, const char *name);
+
+// Maps an existing object for a consumer, returns 0 on success
+int shm_attach(struct chip8_shm *shm, const char *name);
+
+void shm_publish(struct chip8_shm *shm, const struct chip8 *cpu);
+
+// Applies queued key commands, returns 1 if a reset was requested
+int shm_poll(struct chip8_shm *shm);
+
+// Consumer side, the newest frame or NULL if none was published yet.
+// The slot may be overwritten while it is read, check with shm_valid.
+const struct shm_frame *shm_latest(const struct chip8_shm *shm, uint32_t *seq);
+
+// Returns 1 if the frame wasn't written since shm_latest returned seq
+int shm_valid(const struct shm_frame *frame, uint32_t seq);
+
+// Queues a command, returns 1 if the queue is full
+int shm_send(struct chip8_shm *shm, uint32_t cmd);
+
+void shm_close(struct chip8_shm *shm);
+
+#endif
@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shm.h"
+
+// chippy-shm, example consumer of chippy --shm
+//   chippy-shm NAME [SECONDS]    print the state once per second
+//   chippy-shm NAME key K 0|1    release or press key K
+//   chippy-shm NAME reset        reset the cpu
+
+static struct chip8_shm shm;
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+static int watch(int seconds)
+{
+    uint64_t last = 0;
+    unsigned long torn = 0;
+
+    for(int s=0; s<seconds; s++)
+    {
+        uint32_t seq;
+        const struct shm_frame *f = shm_latest(&shm, &seq);
+        if(f == NULL)
+        {
+            printf("no frames yet\n");
+            sleep_ms(1000);
+            continue;
+        }
+
+        // read in place, then make sure the writer didn't overwrite the slot
+        uint64_t frame = f->frame;
+        uint16_t pc = f->pc;
+        uint16_t i = f->i;
+        uint8_t dt = f->dt;
+        unsigned int lit = 0;
+        for(int k=1; k<DISPLAY_FRAME_SIZE; k++)
+            for(uint8_t b = f->disp[k]; b; b &= b - 1)
+                lit++;
+        if(!shm_valid(f, seq))
+        {
+            torn++;
+            s--;
+            continue;
+        }
+
+        printf("frame %llu (+%llu) PC=%03X I=%03X DT=%02X %u px lit, %lu torn reads\n",
+            (unsigned long long)frame, (unsigned long long)(frame - last), pc, i, dt, lit, torn);
+        last = frame;
+        sleep_ms(1000);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: chippy-shm NAME [SECONDS] | NAME key K 0|1 | NAME reset\n");
+        return 1;
+    }
+    if(shm_attach(&shm, argv[1]) != 0)
+    {
+        printf("Failed to attach to %s\n", argv[1]);
+        return 1;
+    }
+
+    int result = 0;
+    if(argc == 5 && strcmp(argv[2], "key") == 0)
+        result = shm_send(&shm, SHM_CMD(SHM_CMD_KEY, strtoul(argv[3], NULL, 16) & 0xf, atoi(argv[4]) != 0));
+    else if(argc == 3 && strcmp(argv[2], "reset") == 0)
+        result = shm_send(&shm, SHM_CMD(SHM_CMD_RESET, 0, 0));
+    else
+        result = watch(argc > 2 ? atoi(argv[2]) : 10);
+    if(result != 0)
+        printf("Command queue is full\n");
+
+    shm_close(&shm);
+    return result;
+}
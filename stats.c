@@ -0,0 +1,118 @@
+#include <string.h>
+#include <stdlib.h>
+#include "stats.h"
+
+void stats_init(struct chip8_stats *stats, uint64_t now_us)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->ips_start_us = now_us;
+}
+
+void stats_frame(struct chip8_stats *stats, uint64_t start_us, uint32_t work_us, uint32_t cycles)
+{
+    uint32_t jitter = 0;
+    if(stats->last_frame_us != 0)
+    {
+        uint64_t period = start_us - stats->last_frame_us;
+        jitter = period > STATS_FRAME_US ? period - STATS_FRAME_US : STATS_FRAME_US - period;
+    }
+    stats->last_frame_us = start_us;
+
+    stats->frame_us[stats->pos] = work_us;
+    stats->jitter_us[stats->pos] = jitter;
+    stats->pos = (stats->pos + 1) % STATS_HISTORY;
+
+    stats->frames++;
+    if(work_us > STATS_FRAME_US)
+        stats->frames_dropped++;
+    stats->cycles += cycles;
+
+    stats->ips_cycles += cycles;
+    if(start_us - stats->ips_start_us >= 1000000)
+    {
+        stats->ips = (uint32_t)(stats->ips_cycles * 1000000 / (start_us - stats->ips_start_us));
+        stats->ips_cycles = 0;
+        stats->ips_start_us = start_us;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint32_t stats_percentile(const struct chip8_stats *stats, const uint32_t *samples, int p)
+{
+    uint32_t sorted[STATS_HISTORY];
+    int n = stats->frames < STATS_HISTORY ? (int)stats->frames : STATS_HISTORY;
+    if(n == 0) return 0;
+
+    memcpy(sorted, samples, sizeof(sorted));
+    qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+    return sorted[(n - 1) * p / 100];
+}
+
+static void write_quantiles(const struct chip8_stats *stats, const uint32_t *samples, const char *name, FILE *out)
+{
+    static const int quantiles[] = { 50, 90, 99, 100 };
+
+    fprintf(out, "# TYPE %s summary\n", name);
+    for(unsigned i=0; i<sizeof(quantiles)/sizeof(quantiles[0]); i++)
+    {
+        fprintf(out, "%s{quantile=\"%.2f\"} %.6f\n", name,
+            quantiles[i] / 100.0,
+            stats_percentile(stats, samples, quantiles[i]) / 1e6);
+    }
+}
+
+void stats_write(const struct chip8_stats *stats, const struct media_stats *ms, FILE *out)
+{
+    fprintf(out, "# TYPE chippy_instructions_per_second gauge\n");
+    fprintf(out, "chippy_instructions_per_second %u\n", stats->ips);
+    fprintf(out, "# TYPE chippy_instructions_total counter\n");
+    fprintf(out, "chippy_instructions_total %llu\n", (unsigned long long)stats->cycles);
+    fprintf(out, "# TYPE chippy_frames_total counter\n");
+    fprintf(out, "chippy_frames_total %llu\n", (unsigned long long)stats->frames);
+    fprintf(out, "# TYPE chippy_frames_dropped_total counter\n");
+    fprintf(out, "chippy_frames_dropped_total %llu\n", (unsigned long long)stats->frames_dropped);
+
+    write_quantiles(stats, stats->frame_us, "chippy_frame_seconds", out);
+    write_quantiles(stats, stats->jitter_us, "chippy_frame_jitter_seconds", out);
+
+    fprintf(out, "# TYPE chippy_sleeps_total counter\n");
+    fprintf(out, "chippy_sleeps_total %llu\n", (unsigned long long)ms->sleeps);
+    fprintf(out, "# TYPE chippy_sleep_overshoot_seconds_total counter\n");
+    fprintf(out, "chippy_sleep_overshoot_seconds_total %.6f\n", ms->sleep_overshoot_us / 1e6);
+    fprintf(out, "# TYPE chippy_sleep_overshoot_max_seconds gauge\n");
+    fprintf(out, "chippy_sleep_overshoot_max_seconds %.6f\n", ms->sleep_overshoot_max_us / 1e6);
+
+    fprintf(out, "# TYPE chippy_audio_callbacks_total counter\n");
+    fprintf(out, "chippy_audio_callbacks_total %llu\n", (unsigned long long)ms->audio_callbacks);
+    fprintf(out, "# TYPE chippy_audio_callback_seconds_total counter\n");
+    fprintf(out, "chippy_audio_callback_seconds_total %.6f\n", ms->audio_callback_us / 1e6);
+    fprintf(out, "# TYPE chippy_audio_callback_max_seconds gauge\n");
+    fprintf(out, "chippy_audio_callback_max_seconds %.6f\n", ms->audio_callback_max_us / 1e6);
+    fprintf(out, "# TYPE chippy_audio_underruns_total counter\n");
+    fprintf(out, "chippy_audio_underruns_total %llu\n", (unsigned long long)ms->audio_underruns);
+}
+
+int stats_write_file(const struct chip8_stats *stats, const struct media_stats *ms, const char *path)
+{
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fs = fopen(tmp_path, "w");
+    if(fs == NULL)
+        return 1;
+    stats_write(stats, ms, fs);
+    if(fclose(fs) != 0)
+        return 1;
+
+    // scrapers must never see a half written file
+#ifdef _WIN32
+    remove(path);
+#endif
+    return rename(tmp_path, path) != 0;
+}
@@ -0,0 +1,55 @@
+#ifndef CHIPPY_STATS_H
+#define CHIPPY_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_HISTORY 128 // frames kept for percentiles
+#define STATS_FRAME_US 16667 // host frame budget
+
+// Counters maintained by the media layer, the audio ones are written
+// from the audio callback thread, so they are only approximate
+struct media_stats
+{
+    uint64_t sleeps;
+    uint64_t sleep_overshoot_us; // total time slept longer than asked
+    uint32_t sleep_overshoot_max_us;
+    uint64_t audio_callbacks;
+    uint64_t audio_callback_us; // total time spent in the callback
+    uint32_t audio_callback_max_us;
+    uint64_t audio_underruns; // callback came later than the buffer lasted
+    uint64_t audio_last_us; // time of the last callback, 0 after pause
+};
+
+// Rolling counters of the main loop
+struct chip8_stats
+{
+    uint64_t frames;
+    uint64_t frames_dropped; // frames that didn't fit the budget
+    uint64_t cycles;
+    uint64_t last_frame_us; // start of the previous frame
+    uint32_t frame_us[STATS_HISTORY]; // host time spent per frame
+    uint32_t jitter_us[STATS_HISTORY]; // |frame period - budget|
+    uint32_t pos;
+
+    uint64_t ips_start_us; // start of the current IPS window
+    uint64_t ips_cycles; // cycles in the current IPS window
+    uint32_t ips; // emulated instructions per second, last window
+};
+
+void stats_init(struct chip8_stats *stats, uint64_t now_us);
+
+// Account one host frame which started at start_us and took work_us
+// of host time (without sleeping) to run cycles instructions
+void stats_frame(struct chip8_stats *stats, uint64_t start_us, uint32_t work_us, uint32_t cycles);
+
+// p in [0, 100] over the last STATS_HISTORY samples
+uint32_t stats_percentile(const struct chip8_stats *stats, const uint32_t *samples, int p);
+
+// Prometheus text exposition format
+void stats_write(const struct chip8_stats *stats, const struct media_stats *ms, FILE *out);
+
+// Write to path atomically (temporary file + rename), returns 0 on success
+int stats_write_file(const struct chip8_stats *stats, const struct media_stats *ms, const char *path);
+
+#endif
@@ -0,0 +1,380 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include "stream.h"
+
+size_t stream_rle_encode(const uint8_t *delta, uint8_t *out)
+{
+    size_t pos = 0;
+    size_t len = 0;
+
+    while(pos < STREAM_DISP_SIZE)
+    {
+        uint8_t zeros = 0;
+        while(pos < STREAM_DISP_SIZE && delta[pos] == 0 && zeros < 255)
+        {
+            pos++;
+            zeros++;
+        }
+        size_t start = pos;
+        uint8_t lits = 0;
+        while(pos < STREAM_DISP_SIZE && delta[pos] != 0 && lits < 255)
+        {
+            pos++;
+            lits++;
+        }
+        if(lits == 0 && pos == STREAM_DISP_SIZE)
+            break;
+        out[len++] = zeros;
+        out[len++] = lits;
+        memcpy(out + len, delta + start, lits);
+        len += lits;
+    }
+    return len;
+}
+
+int stream_rle_decode(const uint8_t *in, size_t len, uint8_t *delta)
+{
+    size_t pos = 0;
+    size_t out = 0;
+
+    memset(delta, 0, STREAM_DISP_SIZE);
+    while(pos < len)
+    {
+        if(pos + 2 > len)
+            return -1;
+        size_t zeros = in[pos];
+        size_t lits = in[pos + 1];
+        pos += 2;
+        if(pos + lits > len || out + zeros + lits > STREAM_DISP_SIZE)
+            return -1;
+        out += zeros;
+        memcpy(delta + out, in + pos, lits);
+        out += lits;
+        pos += lits;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    for(int k=0; k<8; k++)
+        p[k] = (uint8_t)(v >> (8 * k));
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for(int k=7; k>=0; k--)
+        v = (v << 8) | p[k];
+    return v;
+}
+
+// Fills the address for "unix:PATH" or "tcp:PORT", returns its length or 0
+static socklen_t parse_addr(const char *addr, struct sockaddr_storage *ss)
+{
+    memset(ss, 0, sizeof(*ss));
+    if(strncmp(addr, "unix:", 5) == 0)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)ss;
+        if(strlen(addr + 5) >= sizeof(un->sun_path))
+            return 0;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, addr + 5);
+        return sizeof(*un);
+    }
+    if(strncmp(addr, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)ss;
+        int port = atoi(addr + 4);
+        if(port <= 0 || port > 65535)
+            return 0;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sizeof(*in);
+    }
+    return 0;
+}
+
+static int set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int stream_listen(struct chip8_stream *st, const char *addr)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = parse_addr(addr, &ss);
+    int one = 1;
+
+    memset(st, 0, sizeof(*st));
+    st->listen_fd = -1;
+    for(int c=0; c<STREAM_MAX_CLIENTS; c++)
+        st->clients[c].fd = -1;
+    if(len == 0)
+        return 1;
+
+    // a viewer going away must not kill the emulator
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if(fd < 0)
+        return 1;
+    if(ss.ss_family == AF_UNIX)
+        unlink(((struct sockaddr_un *)&ss)->sun_path);
+    else
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, (struct sockaddr *)&ss, len) != 0 || listen(fd, STREAM_MAX_CLIENTS) != 0
+        || set_nonblock(fd) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    st->listen_fd = fd;
+    return 0;
+}
+
+static void update_keys(struct chip8_stream *st)
+{
+    st->keys = 0;
+    for(int c=0; c<STREAM_MAX_CLIENTS; c++)
+        if(st->clients[c].fd >= 0)
+            st->keys |= st->clients[c].keys;
+}
+
+static void drop_client(struct chip8_stream *st, struct stream_client *cl)
+{
+    close(cl->fd);
+    cl->fd = -1;
+    cl->keys = 0;
+    update_keys(st);
+}
+
+// Returns 0 once the output buffer is empty
+static int flush_client(struct chip8_stream *st, struct stream_client *cl)
+{
+    while(cl->out_pos < cl->out_len)
+    {
+        ssize_t n = send(cl->fd, cl->out + cl->out_pos, cl->out_len - cl->out_pos, 0);
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 1;
+        if(n <= 0)
+        {
+            drop_client(st, cl);
+            return 1;
+        }
+        cl->out_pos += (uint32_t)n;
+        st->bytes_sent += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Handles complete messages in the input buffer, returns -1 on garbage
+static int parse_input(struct chip8_stream *st, struct stream_client *cl, uint64_t now_us)
+{
+    uint32_t pos = 0;
+
+    while(pos < cl->in_len)
+    {
+        const uint8_t *m = cl->in + pos;
+        uint32_t left = cl->in_len - pos;
+        if(m[0] == 'K')
+        {
+            if(left < 3)
+                break;
+            if(m[1] > 0xf)
+                return -1;
+            if(m[2])
+                cl->keys |= (uint16_t)(1 << m[1]);
+            else
+                cl->keys &= (uint16_t)~(1 << m[1]);
+            pos += 3;
+        }
+        else if(m[0] == 'A')
+        {
+            if(left < 9)
+                break;
+            uint64_t sent = get64(m + 1);
+            if(sent <= now_us)
+            {
+                uint32_t rtt = (uint32_t)(now_us - sent);
+                st->acks++;
+                st->rtt_us_sum += rtt;
+                if(rtt > st->rtt_us_max)
+                    st->rtt_us_max = rtt;
+            }
+            pos += 9;
+        }
+        else
+            return -1;
+    }
+    memmove(cl->in, cl->in + pos, cl->in_len - pos);
+    cl->in_len -= pos;
+    return 0;
+}
+
+void stream_poll(struct chip8_stream *st, uint64_t now_us)
+{
+    if(st->listen_fd < 0)
+        return;
+
+    int fd;
+    while((fd = accept(st->listen_fd, NULL, NULL)) >= 0)
+    {
+        struct stream_client *cl = NULL;
+        for(int c=0; c<STREAM_MAX_CLIENTS && cl == NULL; c++)
+            if(st->clients[c].fd < 0)
+                cl = &st->clients[c];
+        if(cl == NULL || set_nonblock(fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        // the first frame is a delta against a blank display
+        memset(cl, 0, sizeof(*cl));
+        cl->fd = fd;
+    }
+
+    for(int c=0; c<STREAM_MAX_CLIENTS; c++)
+    {
+        struct stream_client *cl = &st->clients[c];
+        if(cl->fd < 0)
+            continue;
+        for(;;)
+        {
+            ssize_t n = recv(cl->fd, cl->in + cl->in_len, sizeof(cl->in) - cl->in_len, 0);
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if(n <= 0)
+            {
+                drop_client(st, cl);
+                break;
+            }
+            cl->in_len += (uint32_t)n;
+            if(parse_input(st, cl, now_us) != 0)
+            {
+                drop_client(st, cl);
+                break;
+            }
+        }
+    }
+    update_keys(st);
+}
+
+void stream_frame(struct chip8_stream *st, const uint8_t *disp, uint64_t now_us)
+{
+    uint8_t delta[STREAM_DISP_SIZE];
+
+    st->seq++;
+    for(int c=0; c<STREAM_MAX_CLIENTS; c++)
+    {
+        struct stream_client *cl = &st->clients[c];
+        if(cl->fd < 0)
+            continue;
+        // a viewer still receiving the last frame gets a larger delta later
+        if(flush_client(st, cl) != 0)
+        {
+            if(cl->fd >= 0)
+                st->frames_busy++;
+            continue;
+        }
+        if(memcmp(cl->prev, disp, STREAM_DISP_SIZE) == 0)
+            continue;
+
+        for(int k=0; k<STREAM_DISP_SIZE; k++)
+            delta[k] = cl->prev[k] ^ disp[k];
+        size_t len = stream_rle_encode(delta, cl->out + STREAM_FRAME_HEADER);
+        cl->out[0] = 'F';
+        cl->out[1] = (uint8_t)st->seq;
+        cl->out[2] = (uint8_t)(st->seq >> 8);
+        cl->out[3] = (uint8_t)(st->seq >> 16);
+        cl->out[4] = (uint8_t)(st->seq >> 24);
+        put64(cl->out + 5, now_us);
+        cl->out[13] = (uint8_t)len;
+        cl->out[14] = (uint8_t)(len >> 8);
+        cl->out_pos = 0;
+        cl->out_len = (uint32_t)(STREAM_FRAME_HEADER + len);
+        memcpy(cl->prev, disp, STREAM_DISP_SIZE);
+        st->frames++;
+        st->bytes_raw += STREAM_DISP_SIZE;
+        flush_client(st, cl);
+    }
+}
+
+void stream_close(struct chip8_stream *st)
+{
+    for(int c=0; c<STREAM_MAX_CLIENTS; c++)
+        if(st->clients[c].fd >= 0)
+            drop_client(st, &st->clients[c]);
+    if(st->listen_fd >= 0)
+        close(st->listen_fd);
+    st->listen_fd = -1;
+}
+
+int stream_connect(const char *addr)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = parse_addr(addr, &ss);
+    if(len == 0)
+        return -1;
+
+    int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    if(connect(fd, (struct sockaddr *)&ss, len) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#else
+
+int stream_listen(struct chip8_stream *st, const char *addr)
+{
+    (void)addr;
+    memset(st, 0, sizeof(*st));
+    st->listen_fd = -1;
+    return 1;
+}
+
+void stream_poll(struct chip8_stream *st, uint64_t now_us)
+{
+    (void)st;
+    (void)now_us;
+}
+
+void stream_frame(struct chip8_stream *st, const uint8_t *disp, uint64_t now_us)
+{
+    (void)st;
+    (void)disp;
+    (void)now_us;
+}
+
+void stream_close(struct chip8_stream *st)
+{
+    (void)st;
+}
+
+int stream_connect(const char *addr)
+{
+    (void)addr;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CHIPPY_STREAM_H
+#define CHIPPY_STREAM_H
+
+// Streams the display to viewers over a local socket. Each frame is the
+// XOR of the packed display with the one the viewer has, run-length
+// encoded, unchanged frames aren't sent. Viewers send key states and
+// acknowledge frames over the same connection, the acks give the round
+// trip latency (acks are read once per frame, so up to a frame late).
+// POSIX only.
+//
+// Messages (little endian):
+//   server: 'F', u32 seq, u64 send_us, u16 len, RLE delta
+//   viewer: 'K', u8 key, u8 state
+//           'A', u64 send_us of the frame
+// RLE delta: pairs of u8 zero count, u8 literal count, literal bytes,
+//            trailing zeros are left out
+//
+// Addresses are "unix:PATH" or "tcp:PORT" (127.0.0.1 only)
+
+#include <stdint.h>
+#include <stddef.h>
+#include "display.h"
+
+#define STREAM_DISP_SIZE DISPLAY_FRAME_SIZE
+#define STREAM_RLE_BOUND (STREAM_DISP_SIZE * 3 / 2 + 4)
+#define STREAM_FRAME_HEADER 15
+#define STREAM_MAX_CLIENTS 8
+
+struct stream_client
+{
+    int fd; // -1 if unused
+    uint16_t keys;
+    uint8_t prev[STREAM_DISP_SIZE]; // display the viewer has
+    uint32_t out_pos;
+    uint32_t out_len;
+    uint8_t out[STREAM_FRAME_HEADER + STREAM_RLE_BOUND];
+    uint32_t in_len;
+    uint8_t in[16];
+};
+
+struct chip8_stream
+{
+    int listen_fd;
+    uint16_t keys; // keys held by any viewer
+    uint32_t seq;
+    uint64_t frames; // frames sent to viewers
+    uint64_t frames_busy; // frames skipped because a viewer didn't keep up
+    uint64_t bytes_sent;
+    uint64_t bytes_raw; // what the same frames cost as packed displays
+    uint64_t acks;
+    uint64_t rtt_us_sum;
+    uint32_t rtt_us_max;
+    struct stream_client clients[STREAM_MAX_CLIENTS];
+};
+
+// Returns 0 on success
+int stream_listen(struct chip8_stream *st, const char *addr);
+
+// Accepts viewers and reads their keys and acks
+void stream_poll(struct chip8_stream *st, uint64_t now_us);
+
+// Sends the display to every viewer it changed for
+void stream_frame(struct chip8_stream *st, const uint8_t *disp, uint64_t now_us);
+
+void stream_close(struct chip8_stream *st);
+
+// Connects a viewer, returns the socket or -1
+int stream_connect(const char *addr);
+
+size_t stream_rle_encode(const uint8_t *delta, uint8_t *out);
+
+// Returns 0 on success, -1 if the data is corrupt
+int stream_rle_decode(const uint8_t *in, size_t len, uint8_t *delta);
+
+#endif
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stream.h"
+
+// chippy-view, test viewer for chippy --stream
+//   chippy-view ADDR [-q] [-n FRAMES]
+// prints every frame (unless -q) and the bandwidth once per second,
+// lines like "+5" or "-5" on stdin press and release key 5
+
+#ifndef _WIN32
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static uint8_t disp[STREAM_DISP_SIZE];
+
+static uint64_t us_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int send_all(int fd, const uint8_t *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = send(fd, buf, len, 0);
+        if(n <= 0)
+            return 1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void print_disp(uint32_t seq)
+{
+    char line[DISPLAY_WIDTH + 1];
+    int width = display_width(disp);
+    printf("frame %u\n", seq);
+    for(int y=0; y<display_height(disp); y++)
+    {
+        for(int x=0; x<width; x++)
+            line[x] = ".#+*"[display_pixel(disp, x, y)];
+        line[width] = 0;
+        printf("%s\n", line);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *addr = NULL;
+    int quiet = 0;
+    long max_frames = -1;
+
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "-q") == 0)
+            quiet = 1;
+        else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            max_frames = atol(argv[++i]);
+        else
+            addr = argv[i];
+    }
+    if(addr == NULL)
+    {
+        printf("usage: chippy-view unix:PATH|tcp:PORT [-q] [-n FRAMES]\n");
+        return 1;
+    }
+
+    int fd = stream_connect(addr);
+    if(fd < 0)
+    {
+        printf("Failed to connect to %s\n", addr);
+        return 1;
+    }
+
+    static uint8_t in[4096];
+    size_t in_len = 0;
+    uint8_t delta[STREAM_DISP_SIZE];
+    uint64_t frames = 0, bytes = 0, interval_frames = 0, interval_bytes = 0;
+    uint64_t us_report = us_now();
+    struct pollfd fds[2] = { { fd, POLLIN, 0 }, { 0, POLLIN, 0 } };
+
+    while(max_frames < 0 || (long)frames < max_frames)
+    {
+        if(poll(fds, 2, 100) < 0)
+            break;
+
+        if(fds[1].revents & POLLIN)
+        {
+            char line[16];
+            unsigned int key;
+            if(fgets(line, sizeof(line), stdin) == NULL)
+                fds[1].fd = -1;
+            else if((line[0] == '+' || line[0] == '-') && sscanf(line + 1, "%x", &key) == 1 && key <= 0xf)
+            {
+                uint8_t msg[3] = { 'K', (uint8_t)key, line[0] == '+' };
+                if(send_all(fd, msg, sizeof(msg)) != 0)
+                    break;
+            }
+        }
+
+        if(fds[0].revents & (POLLIN | POLLHUP))
+        {
+            ssize_t n = recv(fd, in + in_len, sizeof(in) - in_len, 0);
+            if(n <= 0)
+                break;
+            in_len += (size_t)n;
+            bytes += (uint64_t)n;
+            interval_bytes += (uint64_t)n;
+
+            size_t pos = 0;
+            while(in_len - pos >= STREAM_FRAME_HEADER)
+            {
+                const uint8_t *m = in + pos;
+                if(m[0] != 'F')
+                {
+                    printf("Corrupt stream\n");
+                    return 1;
+                }
+                size_t len = m[13] | (size_t)m[14] << 8;
+                if(in_len - pos < STREAM_FRAME_HEADER + len)
+                    break;
+                if(stream_rle_decode(m + STREAM_FRAME_HEADER, len, delta) != 0)
+                {
+                    printf("Corrupt frame\n");
+                    return 1;
+                }
+                for(int k=0; k<STREAM_DISP_SIZE; k++)
+                    disp[k] ^= delta[k];
+
+                // echo the send time so the server can measure the round trip
+                uint8_t ack[9];
+                ack[0] = 'A';
+                memcpy(ack + 1, m + 5, 8);
+                if(send_all(fd, ack, sizeof(ack)) != 0)
+                    return 1;
+
+                uint32_t seq = m[1] | (uint32_t)m[2] << 8 | (uint32_t)m[3] << 16 | (uint32_t)m[4] << 24;
+                if(!quiet)
+                    print_disp(seq);
+                frames++;
+                interval_frames++;
+                pos += STREAM_FRAME_HEADER + len;
+            }
+            memmove(in, in + pos, in_len - pos);
+            in_len -= pos;
+        }
+
+        uint64_t now = us_now();
+        if(now - us_report >= 1000000)
+        {
+            fprintf(stderr, "%llu frames/s, %llu bytes/s, %.1f bytes/frame (raw %d)\n",
+                (unsigned long long)interval_frames, (unsigned long long)interval_bytes,
+                interval_frames ? (double)interval_bytes / interval_frames : 0.0, STREAM_DISP_SIZE);
+            interval_frames = 0;
+            interval_bytes = 0;
+            us_report = now;
+        }
+    }
+
+    fprintf(stderr, "%llu frames, %llu bytes, %.1f bytes/frame\n",
+        (unsigned long long)frames, (unsigned long long)bytes,
+        frames ? (double)bytes / frames : 0.0);
+    close(fd);
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    printf("chippy-view needs POSIX sockets\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "term.h"
+#include "media.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+
+// same layout as the SDL keys, y and z both work for A
+static const char key_chars[] = "x123qweasdyc4rfv";
+
+// glyphs for the upper and lower pixel of a cell
+static const char *const glyphs[4] = { " ", "\xe2\x96\x80", "\xe2\x96\x84", "\xe2\x96\x88" };
+
+static struct termios saved_termios;
+static struct chip8_term *active_term;
+
+static void put(struct chip8_term *term, const char *s)
+{
+    size_t n = strlen(s);
+    memcpy(term->out + term->len, s, n);
+    term->len += (uint32_t)n;
+}
+
+static void flush(struct chip8_term *term)
+{
+    uint32_t pos = 0;
+    while(pos < term->len)
+    {
+        ssize_t n = write(STDOUT_FILENO, term->out + pos, term->len - pos);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        pos += (uint32_t)n;
+    }
+    term->bytes += pos;
+    term->len = 0;
+}
+
+static void restore_at_exit(void)
+{
+    if(active_term != NULL)
+        term_close(active_term);
+}
+
+int term_init(struct chip8_term *term)
+{
+    struct termios raw;
+
+    memset(term, 0, sizeof(*term));
+    memset(term->cells, 0xff, sizeof(term->cells));
+    if(!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios) != 0)
+        return 1;
+
+    raw = saved_termios;
+    raw.c_iflag &= ~(tcflag_t)(IXON | ICRNL | INLCR | ISTRIP);
+    raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0)
+        return 1;
+
+    term->active = 1;
+    if(active_term == NULL)
+        atexit(restore_at_exit);
+    active_term = term;
+
+    // alternate screen, hide the cursor, clear
+    put(term, "\x1b[?1049h\x1b[?25l\x1b[2J");
+    flush(term);
+    return 0;
+}
+
+void term_close(struct chip8_term *term)
+{
+    if(!term->active)
+        return;
+    term->active = 0;
+    active_term = NULL;
+    put(term, "\x1b[?25h\x1b[?1049l");
+    flush(term);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+}
+
+void term_render(struct chip8_term *term, const uint8_t *disp)
+{
+    char move[32];
+    int cols = display_width(disp);
+    int rows = display_height(disp) / 2;
+
+    // the other mode has another size, start over
+    if(disp[0] != term->hires)
+    {
+        put(term, "\x1b[2J");
+        memset(term->cells, 0xff, sizeof(term->cells));
+        term->hires = disp[0];
+    }
+
+    for(int row=0; row<rows; row++)
+    {
+        int cursor = -1; // column the cursor is in, -1 if elsewhere
+
+        for(int col=0; col<cols; col++)
+        {
+            uint8_t cell = (display_pixel(disp, col, row * 2) ? 1 : 0) | (display_pixel(disp, col, row * 2 + 1) ? 2 : 0);
+            if(cell == term->cells[row][col])
+                continue;
+
+            // rewriting up to two unchanged cells is shorter than a move
+            if(cursor >= 0 && col - cursor <= 2)
+            {
+                for(; cursor < col; cursor++)
+                    put(term, glyphs[term->cells[row][cursor]]);
+            }
+            else
+            {
+                snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, col + 1);
+                put(term, move);
+            }
+            put(term, glyphs[cell]);
+            term->cells[row][col] = cell;
+            cursor = col + 1;
+        }
+    }
+    if(term->buzzer == 1)
+    {
+        put(term, "\a");
+        term->buzzer = 2;
+    }
+    term->frames++;
+    if(term->len > 0)
+        flush(term);
+}
+
+void term_poll(struct chip8_term *term, uint64_t now_us)
+{
+    char buf[64];
+    ssize_t n;
+
+    while((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+    {
+        for(ssize_t k=0; k<n; k++)
+        {
+            char c = buf[k];
+            if(c == 3 || c == 0x1b) // ctrl-c or escape
+                term->exit_requested = 1;
+            if(c >= 'A' && c <= 'Z')
+                c = (char)(c - 'A' + 'a');
+            if(c == 'z')
+                c = 'y';
+            const char *p = c ? strchr(key_chars, c) : NULL;
+            if(p != NULL)
+                term->key_until_us[p - key_chars] = now_us + TERM_KEY_HOLD_US;
+        }
+    }
+}
+
+#else
+
+int term_init(struct chip8_term *term)
+{
+    memset(term, 0, sizeof(*term));
+    return 1;
+}
+
+void term_close(struct chip8_term *term)
+{
+    (void)term;
+}
+
+void term_render(struct chip8_term *term, const uint8_t *disp)
+{
+    (void)term;
+    (void)disp;
+}
+
+void term_poll(struct chip8_term *term, uint64_t now_us)
+{
+    (void)term;
+    (void)now_us;
+}
+
+#endif
+
+void term_set_buzzer(struct chip8_term *term, int active)
+{
+    // one bell per sound, rung with the next frame
+    if(!active)
+        term->buzzer = 0;
+    else if(term->buzzer == 0)
+        term->buzzer = 1;
+}
+
+int term_key_down(struct chip8_term *term, uint8_t key, uint64_t now_us)
+{
+    return now_us < term->key_until_us[key & 0xf];
+}
+
+// media backend drawing to the terminal on stdout
+
+static struct chip8_term term;
+
+static int backend_init(struct chip8_media *media)
+{
+    (void)media;
+    if (term_init(&term) != 0)
+    {
+        printf("The term media needs a terminal on stdin\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void backend_close(struct chip8_media *media)
+{
+    (void)media;
+    term_close(&term);
+    printf("Terminal output %llu bytes, %.1f per frame\n",
+        (unsigned long long)term.bytes,
+        term.frames ? (double)term.bytes / term.frames : 0.0);
+}
+
+static void backend_present(struct chip8_media *media, const uint8_t *disp, const struct media_graph *graph)
+{
+    (void)media;
+    (void)graph;
+    term_render(&term, disp);
+}
+
+static void backend_set_buzzer(struct chip8_media *media, int active)
+{
+    (void)media;
+    term_set_buzzer(&term, active);
+}
+
+static void backend_set_title(struct chip8_media *media, const char *title)
+{
+    (void)media;
+    (void)title;
+}
+
+static int backend_poll_exit(struct chip8_media *media)
+{
+    term_poll(&term, media_clock_us(media));
+    return term.exit_requested;
+}
+
+static int backend_key_down(struct chip8_media *media, uint8_t key)
+{
+    return term_key_down(&term, key, media_clock_us(media));
+}
+
+const struct media_backend media_term =
+{
+    "term",
+    backend_init,
+    backend_close,
+    backend_present,
+    backend_set_buzzer,
+    backend_set_title,
+    backend_poll_exit,
+    backend_key_down,
+    media_clock_us,
+    media_sleep_us,
+    NULL,
+    NULL,
+    NULL
+};
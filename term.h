@@ -0,0 +1,50 @@
+#ifndef CHIPPY_TERM_H
+#define CHIPPY_TERM_H
+
+// Draws the display in a terminal with Unicode half blocks, two pixels
+// per cell (64x16 cells in lores, 128x32 in hires), and reads keys from
+// stdin in raw mode. Only cells which
+// changed since the last frame are written, so the output per frame
+// scales with the change and not with the screen size.
+// Terminals only report key presses, a key counts as held for
+// TERM_KEY_HOLD_US after its last press (or auto repeat). POSIX only.
+
+#include <stdint.h>
+
+#define TERM_COLS 128
+#define TERM_ROWS 32
+#define TERM_KEY_HOLD_US 200000
+#define TERM_OUT_SIZE (TERM_COLS * TERM_ROWS * 12 + 64)
+
+struct chip8_term
+{
+    int active;
+    int exit_requested;
+    int buzzer;
+    uint64_t key_until_us[16]; // key is held until then
+    uint8_t cells[TERM_ROWS][TERM_COLS]; // shown glyphs, 0xff unknown
+    uint8_t hires; // mode of cells
+    uint64_t frames;
+    uint64_t bytes; // written to the terminal
+    uint32_t len;
+    char out[TERM_OUT_SIZE];
+};
+
+// Switches the terminal to raw mode and the alternate screen,
+// returns 0 on success
+int term_init(struct chip8_term *term);
+
+// Restores the terminal, also registered with atexit
+void term_close(struct chip8_term *term);
+
+// Draws the packed display, see display.h
+void term_render(struct chip8_term *term, const uint8_t *disp);
+
+void term_set_buzzer(struct chip8_term *term, int active);
+
+// Reads pending input, call once per frame
+void term_poll(struct chip8_term *term, uint64_t now_us);
+
+int term_key_down(struct chip8_term *term, uint8_t key, uint64_t now_us);
+
+#endif
@@ -0,0 +1,359 @@
+#include <string.h>
+#include "cpu.h"
+#include "trace.h"
+
+static const char trace_magic[4] = { 'C', 'H', '8', 'T' };
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void state_from_cpu(struct trace_state *state, const struct chip8 *cpu)
+{
+    memcpy(state->v, cpu->v, 16);
+    state->i = cpu->i;
+    state->sp = cpu->sp;
+    state->dt = cpu_get_dt(cpu);
+    state->st = cpu_get_st(cpu);
+}
+
+// 22 byte header after the magic: version, V0..VF, I, SP, DT, ST
+static void state_encode(const struct trace_state *state, uint8_t *p)
+{
+    p[0] = TRACE_VERSION;
+    memcpy(p + 1, state->v, 16);
+    p[17] = state->i & 0xff;
+    p[18] = state->i >> 8;
+    p[19] = state->sp;
+    p[20] = state->dt;
+    p[21] = state->st;
+}
+
+static void state_decode(struct trace_state *state, const uint8_t *p)
+{
+    memcpy(state->v, p + 1, 16);
+    state->i = p[17] | (p[18] << 8);
+    state->sp = p[19];
+    state->dt = p[20];
+    state->st = p[21];
+}
+
+static int flush_block(struct chip8_trace *trace)
+{
+    if(trace->len == 0)
+        return 0;
+
+    uint8_t header[8];
+    uint32_t packed = lz_compress(&trace->lz, trace->block, trace->len, trace->packed);
+    const uint8_t *data = trace->packed;
+    if(packed >= trace->len)
+    {
+        packed = trace->len;
+        data = trace->block;
+    }
+
+    put32(header, trace->len);
+    put32(header + 4, packed);
+    if(fwrite(header, 1, 8, trace->fs) != 8 || fwrite(data, 1, packed, trace->fs) != packed)
+        return 1;
+
+    trace->bytes_raw += trace->len;
+    trace->bytes_written += 8 + packed;
+    trace->len = 0;
+    return 0;
+}
+
+int trace_open(struct chip8_trace *trace, const char *path, const struct chip8 *cpu)
+{
+    uint8_t header[22];
+
+    trace->fs = fopen(path, "wb");
+    if(trace->fs == NULL)
+        return 1;
+    // blocks are written in one go, no need for stdio buffering
+    setvbuf(trace->fs, NULL, _IONBF, 0);
+
+    trace->count = 0;
+    trace->bytes_raw = 0;
+    trace->bytes_written = sizeof(trace_magic) + sizeof(header);
+    trace->len = 0;
+    trace->failed = 0;
+    trace->timer_tick = cpu->next_tick;
+    trace->dt_end = cpu->dt_end;
+    trace->st_end = cpu->st_end;
+    trace->dt = cpu_get_dt(cpu);
+    trace->st = cpu_get_st(cpu);
+    state_from_cpu(&trace->state, cpu);
+    state_encode(&trace->state, header);
+
+    if(fwrite(trace_magic, 1, sizeof(trace_magic), trace->fs) != sizeof(trace_magic)
+        || fwrite(header, 1, sizeof(header), trace->fs) != sizeof(header))
+    {
+        fclose(trace->fs);
+        trace->fs = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void trace_instr(struct chip8_trace *trace, const struct chip8 *cpu, uint16_t pc, uint16_t opcode)
+{
+    if(trace->failed)
+        return;
+    if(trace->len + TRACE_MAX_RECORD > TRACE_BLOCK && flush_block(trace) != 0)
+    {
+        // e.g. the disk is full, drop the block and stop recording
+        trace->failed = 1;
+        trace->len = 0;
+        return;
+    }
+    if(cpu->next_tick != trace->timer_tick || cpu->dt_end != trace->dt_end || cpu->st_end != trace->st_end)
+    {
+        trace->timer_tick = cpu->next_tick;
+        trace->dt_end = cpu->dt_end;
+        trace->st_end = cpu->st_end;
+        trace->dt = cpu_get_dt(cpu);
+        trace->st = cpu_get_st(cpu);
+    }
+
+    // byte stores alias everything, so work on local copies
+    struct trace_state *s = &trace->state;
+    uint8_t *start = trace->block + trace->len;
+    uint8_t *p = start + 7;
+    uint16_t vmask = 0;
+    uint8_t flags = 0;
+    uint16_t i = cpu->i;
+    uint16_t i_before = s->i; // Fx33 and Fx55 store there, Fx55 may move I
+    uint8_t sp = cpu->sp;
+    uint8_t dt = trace->dt;
+    uint8_t st = trace->st;
+
+    // most instructions change at most one register
+    uint64_t cur[2];
+    uint64_t prev[2];
+    memcpy(cur, cpu->v, 16);
+    memcpy(prev, s->v, 16);
+    if(((cur[0] ^ prev[0]) | (cur[1] ^ prev[1])) != 0)
+    {
+        uint8_t changed[16];
+        int n = 0;
+        for(int r=0; r<16; r++)
+        {
+            if(cpu->v[r] != s->v[r])
+            {
+                vmask |= 1 << r;
+                changed[n++] = cpu->v[r];
+            }
+        }
+        memcpy(s->v, cpu->v, 16);
+        // the flags byte follows the changed values
+        memcpy(start + 6, changed, n);
+        p += n;
+    }
+
+    uint8_t *flags_pos = p - 1;
+    if(i != s->i)
+    {
+        flags |= TRACE_I;
+        s->i = i;
+        *p++ = i & 0xff;
+        *p++ = i >> 8;
+    }
+    if(sp != s->sp)
+    {
+        flags |= TRACE_SP;
+        s->sp = sp;
+        *p++ = sp;
+    }
+    if(dt != s->dt)
+    {
+        flags |= TRACE_DT;
+        s->dt = dt;
+        *p++ = dt;
+    }
+    if(st != s->st)
+    {
+        flags |= TRACE_ST;
+        s->st = st;
+        *p++ = st;
+    }
+
+    // only Fx33 and Fx55 write to memory
+    uint8_t mem_len = 0;
+    if((opcode & 0xf0ff) == 0xf033)
+        mem_len = 3;
+    else if((opcode & 0xf0ff) == 0xf055)
+        mem_len = ((opcode >> 8) & 0xf) + 1;
+    if(mem_len)
+    {
+        flags |= TRACE_MEM;
+        *p++ = i_before & 0xff;
+        *p++ = i_before >> 8;
+        *p++ = mem_len;
+        for(int k=0; k<mem_len; k++)
+            *p++ = cpu->mem[(i_before + k) & 0xfff];
+    }
+
+    start[0] = pc & 0xff;
+    start[1] = pc >> 8;
+    start[2] = opcode & 0xff;
+    start[3] = opcode >> 8;
+    start[4] = vmask & 0xff;
+    start[5] = vmask >> 8;
+    *flags_pos = flags;
+
+    trace->len = (uint32_t)(p - trace->block);
+    trace->count++;
+}
+
+int trace_close(struct chip8_trace *trace)
+{
+    if(trace->fs == NULL)
+        return 1;
+    int result = trace->failed || flush_block(trace) != 0;
+    if(fclose(trace->fs) != 0)
+        result = 1;
+    trace->fs = NULL;
+    return result;
+}
+
+int trace_reader_open(struct trace_reader *reader, const char *path)
+{
+    uint8_t magic[4];
+    uint8_t header[22];
+
+    reader->fs = fopen(path, "rb");
+    if(reader->fs == NULL)
+        return 1;
+    if(fread(magic, 1, 4, reader->fs) != 4 || memcmp(magic, trace_magic, 4) != 0
+        || fread(header, 1, sizeof(header), reader->fs) != sizeof(header)
+        || header[0] != TRACE_VERSION)
+    {
+        fclose(reader->fs);
+        reader->fs = NULL;
+        return 1;
+    }
+    state_decode(&reader->state, header);
+    reader->index = 0;
+    reader->len = 0;
+    reader->pos = 0;
+    return 0;
+}
+
+static int read_block(struct trace_reader *reader)
+{
+    uint8_t header[8];
+    size_t n = fread(header, 1, 8, reader->fs);
+    if(n == 0)
+        return 0;
+    if(n != 8)
+        return -1;
+
+    uint32_t raw = get32(header);
+    uint32_t packed = get32(header + 4);
+    if(raw > TRACE_BLOCK || packed > sizeof(reader->packed))
+        return -1;
+
+    if(packed == raw)
+    {
+        if(fread(reader->block, 1, raw, reader->fs) != raw)
+            return -1;
+    }
+    else
+    {
+        if(fread(reader->packed, 1, packed, reader->fs) != packed)
+            return -1;
+        if(lz_decompress(reader->packed, packed, reader->block, TRACE_BLOCK) != (int32_t)raw)
+            return -1;
+    }
+    reader->len = raw;
+    reader->pos = 0;
+    return 1;
+}
+
+int trace_reader_next(struct trace_reader *reader, struct trace_record *rec)
+{
+    if(reader->pos >= reader->len)
+    {
+        int result = read_block(reader);
+        if(result <= 0)
+            return result;
+    }
+
+    // records never cross blocks, so only the block end needs checking
+    const uint8_t *p = reader->block + reader->pos;
+    const uint8_t *end = reader->block + reader->len;
+    struct trace_state *s = &reader->state;
+
+    if(end - p < 7)
+        return -1;
+    rec->pc = p[0] | (p[1] << 8);
+    rec->opcode = p[2] | (p[3] << 8);
+    rec->vmask = p[4] | (p[5] << 8);
+    p += 6;
+
+    for(int r=0; r<16; r++)
+    {
+        if(rec->vmask & (1 << r))
+        {
+            if(p >= end) return -1;
+            rec->v[r] = s->v[r] = *p++;
+        }
+    }
+
+    if(p >= end) return -1;
+    rec->flags = *p++;
+    if(rec->flags & TRACE_I)
+    {
+        if(end - p < 2) return -1;
+        rec->i = s->i = p[0] | (p[1] << 8);
+        p += 2;
+    }
+    if(rec->flags & TRACE_SP)
+    {
+        if(p >= end) return -1;
+        rec->sp = s->sp = *p++;
+    }
+    if(rec->flags & TRACE_DT)
+    {
+        if(p >= end) return -1;
+        rec->dt = s->dt = *p++;
+    }
+    if(rec->flags & TRACE_ST)
+    {
+        if(p >= end) return -1;
+        rec->st = s->st = *p++;
+    }
+    if(rec->flags & TRACE_MEM)
+    {
+        if(end - p < 3) return -1;
+        rec->mem_addr = p[0] | (p[1] << 8);
+        rec->mem_len = p[2];
+        p += 3;
+        if(rec->mem_len > 16 || end - p < rec->mem_len) return -1;
+        memcpy(rec->mem, p, rec->mem_len);
+        p += rec->mem_len;
+    }
+    else
+        rec->mem_len = 0;
+
+    reader->pos = (uint32_t)(p - reader->block);
+    reader->index++;
+    return 1;
+}
+
+void trace_reader_close(struct trace_reader *reader)
+{
+    if(reader->fs != NULL)
+        fclose(reader->fs);
+    reader->fs = NULL;
+}
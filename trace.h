@@ -0,0 +1,106 @@
+#ifndef CHIPPY_TRACE_H
+#define CHIPPY_TRACE_H
+
+// Binary execution trace. Each executed instruction is stored as its PC,
+// opcode and the registers and memory it changed, records are collected
+// in blocks of up to 64 KiB which are LZ compressed before writing.
+//
+// File layout (little endian):
+//   "CH8T", version, initial V0..VF, I, SP, DT, ST
+//   blocks: u32 raw length, u32 stored length, data
+//           (stored length == raw length means uncompressed)
+//   record: u16 pc, u16 opcode, u16 changed V mask, changed V values,
+//           u8 flags, [u16 I], [u8 SP], [u8 DT], [u8 ST],
+//           [u16 addr, u8 len, bytes written]
+
+#include <stdint.h>
+#include <stdio.h>
+#include "lz.h"
+
+#define TRACE_VERSION 1
+#define TRACE_BLOCK LZ_MAX_BLOCK
+#define TRACE_MAX_RECORD 64
+
+#define TRACE_I 0x01
+#define TRACE_SP 0x02
+#define TRACE_DT 0x04
+#define TRACE_ST 0x08
+#define TRACE_MEM 0x10
+
+struct chip8;
+
+struct trace_record
+{
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t vmask; // changed registers
+    uint8_t v[16]; // new values, only valid where vmask is set
+    uint8_t flags; // TRACE_*
+    uint16_t i;
+    uint8_t sp;
+    uint8_t dt;
+    uint8_t st;
+    uint16_t mem_addr;
+    uint8_t mem_len;
+    uint8_t mem[16];
+};
+
+// Register state both sides use to compute the deltas
+struct trace_state
+{
+    uint8_t v[16];
+    uint16_t i;
+    uint8_t sp;
+    uint8_t dt;
+    uint8_t st;
+};
+
+struct chip8_trace
+{
+    FILE *fs;
+    uint64_t count; // traced instructions
+    uint64_t bytes_raw;
+    uint64_t bytes_written;
+    struct trace_state state;
+    uint8_t failed; // a block couldn't be written, nothing is recorded since
+    // timers as of timer_tick, dt_end and st_end, they only change at ticks
+    // or when set, so trace_instr skips the divisions of cpu_get_dt otherwise
+    uint64_t timer_tick;
+    uint64_t dt_end;
+    uint64_t st_end;
+    uint8_t dt;
+    uint8_t st;
+    uint32_t len; // bytes used in block
+    uint8_t block[TRACE_BLOCK];
+    uint8_t packed[LZ_BOUND(TRACE_BLOCK)];
+    struct lz_state lz;
+};
+
+struct trace_reader
+{
+    FILE *fs;
+    uint64_t index; // records read so far
+    struct trace_state state; // after the last record read
+    uint32_t len;
+    uint32_t pos;
+    uint8_t block[TRACE_BLOCK];
+    uint8_t packed[LZ_BOUND(TRACE_BLOCK)];
+};
+
+// Returns 0 on success
+int trace_open(struct chip8_trace *trace, const char *path, const struct chip8 *cpu);
+
+// Called by cpu_cycle after an instruction at pc was executed
+void trace_instr(struct chip8_trace *trace, const struct chip8 *cpu, uint16_t pc, uint16_t opcode);
+
+// Flushes the last block, returns 0 on success
+int trace_close(struct chip8_trace *trace);
+
+int trace_reader_open(struct trace_reader *reader, const char *path);
+
+// Returns 1 for a record, 0 at the end of the trace and -1 on errors
+int trace_reader_next(struct trace_reader *reader, struct trace_record *rec);
+
+void trace_reader_close(struct trace_reader *reader);
+
+#endif
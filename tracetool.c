@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+// chippy-trace, reads traces written by chippy --trace
+//   chippy-trace dump FILE [COUNT]   print records
+//   chippy-trace diff A B            find the first divergent instruction
+
+static struct trace_reader reader_a;
+static struct trace_reader reader_b;
+
+static void print_record(const struct trace_record *rec, uint64_t index)
+{
+    printf("%10llu  %03X  %04X ", (unsigned long long)index, rec->pc, rec->opcode);
+    for(int r=0; r<16; r++)
+        if(rec->vmask & (1 << r))
+            printf(" V%X=%02X", r, rec->v[r]);
+    if(rec->flags & TRACE_I) printf(" I=%03X", rec->i);
+    if(rec->flags & TRACE_SP) printf(" SP=%X", rec->sp);
+    if(rec->flags & TRACE_DT) printf(" DT=%02X", rec->dt);
+    if(rec->flags & TRACE_ST) printf(" ST=%02X", rec->st);
+    if(rec->flags & TRACE_MEM)
+    {
+        printf(" [%03X]=", rec->mem_addr);
+        for(int k=0; k<rec->mem_len; k++)
+            printf("%02X", rec->mem[k]);
+    }
+    printf("\n");
+}
+
+static void print_state(const char *name, const struct trace_state *s)
+{
+    printf("%s:", name);
+    for(int r=0; r<16; r++)
+        printf(" %02X", s->v[r]);
+    printf("  I=%03X SP=%X DT=%02X ST=%02X\n", s->i, s->sp, s->dt, s->st);
+}
+
+static int states_equal(const struct trace_state *a, const struct trace_state *b)
+{
+    return memcmp(a->v, b->v, 16) == 0 && a->i == b->i && a->sp == b->sp
+        && a->dt == b->dt && a->st == b->st;
+}
+
+static int records_equal(const struct trace_record *a, const struct trace_record *b)
+{
+    if(a->pc != b->pc || a->opcode != b->opcode || a->vmask != b->vmask || a->flags != b->flags)
+        return 0;
+    for(int r=0; r<16; r++)
+        if((a->vmask & (1 << r)) && a->v[r] != b->v[r])
+            return 0;
+    if((a->flags & TRACE_I) && a->i != b->i) return 0;
+    if((a->flags & TRACE_SP) && a->sp != b->sp) return 0;
+    if((a->flags & TRACE_DT) && a->dt != b->dt) return 0;
+    if((a->flags & TRACE_ST) && a->st != b->st) return 0;
+    if((a->flags & TRACE_MEM) && (a->mem_addr != b->mem_addr || a->mem_len != b->mem_len
+        || memcmp(a->mem, b->mem, a->mem_len) != 0))
+        return 0;
+    return 1;
+}
+
+static int dump(const char *path, unsigned long long count)
+{
+    struct trace_record rec;
+    int result = 0;
+
+    if(trace_reader_open(&reader_a, path) != 0)
+    {
+        printf("Failed to open trace %s\n", path);
+        return 1;
+    }
+    print_state("initial", &reader_a.state);
+    while(count-- > 0 && (result = trace_reader_next(&reader_a, &rec)) > 0)
+        print_record(&rec, reader_a.index - 1);
+    trace_reader_close(&reader_a);
+    if(result < 0)
+    {
+        printf("Trace %s is corrupt\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int diff(const char *path_a, const char *path_b)
+{
+    struct trace_record rec_a;
+    struct trace_record rec_b;
+    struct trace_state before_a;
+    struct trace_state before_b;
+
+    if(trace_reader_open(&reader_a, path_a) != 0 || trace_reader_open(&reader_b, path_b) != 0)
+    {
+        printf("Failed to open traces\n");
+        return 1;
+    }
+
+    if(!states_equal(&reader_a.state, &reader_b.state))
+    {
+        printf("Initial states differ\n");
+        print_state("a", &reader_a.state);
+        print_state("b", &reader_b.state);
+        return 2;
+    }
+
+    for(;;)
+    {
+        before_a = reader_a.state;
+        before_b = reader_b.state;
+        int ra = trace_reader_next(&reader_a, &rec_a);
+        int rb = trace_reader_next(&reader_b, &rec_b);
+
+        if(ra < 0 || rb < 0)
+        {
+            printf("Trace %s is corrupt\n", ra < 0 ? path_a : path_b);
+            return 1;
+        }
+        if(ra == 0 && rb == 0)
+        {
+            printf("Traces are identical, %llu instructions\n", (unsigned long long)reader_a.index);
+            return 0;
+        }
+        if(ra == 0 || rb == 0)
+        {
+            printf("Trace %s ends after %llu instructions\n",
+                ra == 0 ? path_a : path_b,
+                (unsigned long long)(ra == 0 ? reader_a.index : reader_b.index));
+            return 2;
+        }
+        if(!records_equal(&rec_a, &rec_b))
+        {
+            printf("First divergence at instruction %llu\n", (unsigned long long)(reader_a.index - 1));
+            print_state("state", &before_a);
+            if(!states_equal(&before_a, &before_b))
+                print_state("state b", &before_b);
+            print_record(&rec_a, reader_a.index - 1);
+            print_record(&rec_b, reader_b.index - 1);
+            return 2;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc >= 3 && strcmp(argv[1], "dump") == 0)
+    {
+        unsigned long long count = ~0ULL;
+        if(argc > 3)
+            sscanf(argv[3], "%llu", &count);
+        return dump(argv[2], count);
+    }
+    if(argc == 4 && strcmp(argv[1], "diff") == 0)
+        return diff(argv[2], argv[3]);
+
+    printf("usage: %s dump FILE [COUNT]\n", argv[0]);
+    printf("       %s diff A B\n", argv[0]);
+    return 1;
+}
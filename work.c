@@ -0,0 +1,342 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include "work.h"
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    for(int k=0; k<4; k++)
+        p[k] = (uint8_t)(v >> (8 * k));
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    for(int k=0; k<8; k++)
+        p[k] = (uint8_t)(v >> (8 * k));
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+// u32 id, u64 rom hash, u32 seed, u32 frames, u16 cycles, u8 quirks,
+// u8 halt check, u16 event count, events of u32 frame, u16 keys
+#define JOB_HEADER 26
+
+size_t work_encode_job(const struct work_job *job, uint8_t *out)
+{
+    put32(out, job->id);
+    put64(out + 4, job->rom_hash);
+    put32(out + 12, job->seed);
+    put32(out + 16, job->frames);
+    put16(out + 20, job->cycles);
+    out[22] = job->quirks;
+    out[23] = job->halt_check;
+    put16(out + 24, job->event_count);
+    uint8_t *p = out + JOB_HEADER;
+    for(int e=0; e<job->event_count; e++)
+    {
+        put32(p, job->events[e].frame);
+        put16(p + 4, job->events[e].keys);
+        p += 6;
+    }
+    return (size_t)(p - out);
+}
+
+int work_decode_job(const uint8_t *in, size_t len, struct work_job *job)
+{
+    if(len < JOB_HEADER)
+        return -1;
+    job->id = get32(in);
+    job->rom_hash = get64(in + 4);
+    job->seed = get32(in + 12);
+    job->frames = get32(in + 16);
+    job->cycles = get16(in + 20);
+    job->quirks = in[22];
+    job->halt_check = in[23];
+    job->event_count = get16(in + 24);
+    if(job->quirks >= QUIRKS_COUNT || job->event_count > WORK_MAX_EVENTS
+        || len != JOB_HEADER + (size_t)job->event_count * 6)
+        return -1;
+    const uint8_t *p = in + JOB_HEADER;
+    for(int e=0; e<job->event_count; e++)
+    {
+        job->events[e].frame = get32(p);
+        job->events[e].keys = get16(p + 4);
+        p += 6;
+    }
+    return 0;
+}
+
+// u32 id, u8 status, u16 pc, u32 frames, u64 cycles, u64 display hash,
+// display
+#define RESULT_SIZE (27 + WORK_DISP_SIZE)
+
+size_t work_encode_result(const struct work_result *res, uint8_t *out)
+{
+    put32(out, res->id);
+    out[4] = res->status;
+    put16(out + 5, res->pc);
+    put32(out + 7, res->frames);
+    put64(out + 11, res->cycles);
+    put64(out + 19, res->disp_hash);
+    memcpy(out + 27, res->disp, WORK_DISP_SIZE);
+    return RESULT_SIZE;
+}
+
+int work_decode_result(const uint8_t *in, size_t len, struct work_result *res)
+{
+    if(len != RESULT_SIZE)
+        return -1;
+    res->id = get32(in);
+    res->status = in[4];
+    res->pc = get16(in + 5);
+    res->frames = get32(in + 7);
+    res->cycles = get64(in + 11);
+    res->disp_hash = get64(in + 19);
+    memcpy(res->disp, in + 27, WORK_DISP_SIZE);
+    return 0;
+}
+
+void work_put_header(uint8_t *out, uint8_t type, size_t len)
+{
+    put32(out, (uint32_t)len);
+    out[4] = type;
+}
+
+uint32_t work_get_header(const uint8_t *in, uint8_t *type)
+{
+    *type = in[4];
+    return get32(in);
+}
+
+#ifndef _WIN32
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int work_listen(const char *addr)
+{
+    int fd = -1;
+    int one = 1;
+
+    // a worker going away must not kill the coordinator
+    signal(SIGPIPE, SIG_IGN);
+
+    if(strncmp(addr, "unix:", 5) == 0)
+    {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        if(strlen(addr + 5) >= sizeof(un.sun_path))
+            return -1;
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, addr + 5);
+        unlink(un.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else if(strncmp(addr, "tcp:", 4) == 0)
+    {
+        struct addrinfo hints;
+        struct addrinfo *ai = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if(getaddrinfo(NULL, addr + 4, &hints, &ai) != 0)
+            return -1;
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd >= 0)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(bind(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(ai);
+    }
+    if(fd >= 0 && listen(fd, 16) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int work_accept(int listen_fd)
+{
+    return accept(listen_fd, NULL, NULL);
+}
+
+int work_connect(const char *addr)
+{
+    int fd = -1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if(strncmp(addr, "unix:", 5) == 0)
+    {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        if(strlen(addr + 5) >= sizeof(un.sun_path))
+            return -1;
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, addr + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && connect(fd, (struct sockaddr *)&un, sizeof(un)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else if(strncmp(addr, "tcp:", 4) == 0)
+    {
+        // "tcp:PORT" or "tcp:HOST:PORT"
+        char host[256] = "127.0.0.1";
+        const char *port = addr + 4;
+        const char *colon = strrchr(port, ':');
+        if(colon != NULL)
+        {
+            size_t host_len = (size_t)(colon - port);
+            if(host_len == 0 || host_len >= sizeof(host))
+                return -1;
+            memcpy(host, port, host_len);
+            host[host_len] = '\0';
+            port = colon + 1;
+        }
+        struct addrinfo hints;
+        struct addrinfo *ai = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host, port, &hints, &ai) != 0)
+            return -1;
+        for(struct addrinfo *a=ai; a != NULL && fd < 0; a=a->ai_next)
+        {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if(fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(ai);
+    }
+    return fd;
+}
+
+static int write_all(int fd, const uint8_t *p, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if(n <= 0)
+            return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, uint8_t *p, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if(n <= 0)
+            return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int work_send(int fd, uint8_t type, const uint8_t *payload, size_t len)
+{
+    // one write, a separate header would wait for the peer's delayed ack
+    uint8_t buf[WORK_HEADER + WORK_MAX_MSG];
+    if(len > WORK_MAX_MSG)
+        return 1;
+    work_put_header(buf, type, len);
+    if(len > 0)
+        memcpy(buf + WORK_HEADER, payload, len);
+    return write_all(fd, buf, WORK_HEADER + len);
+}
+
+int work_recv(int fd, uint8_t *type, uint8_t *payload, size_t max)
+{
+    uint8_t header[WORK_HEADER];
+    if(read_all(fd, header, sizeof(header)) != 0)
+        return -1;
+    uint32_t len = work_get_header(header, type);
+    if(len > max || read_all(fd, payload, len) != 0)
+        return -1;
+    return (int)len;
+}
+
+#else
+
+int work_listen(const char *addr)
+{
+    (void)addr;
+    return -1;
+}
+
+int work_accept(int listen_fd)
+{
+    (void)listen_fd;
+    return -1;
+}
+
+int work_connect(const char *addr)
+{
+    (void)addr;
+    return -1;
+}
+
+int work_send(int fd, uint8_t type, const uint8_t *payload, size_t len)
+{
+    (void)fd;
+    (void)type;
+    (void)payload;
+    (void)len;
+    return 1;
+}
+
+int work_recv(int fd, uint8_t *type, uint8_t *payload, size_t max)
+{
+    (void)fd;
+    (void)type;
+    (void)payload;
+    (void)max;
+    return -1;
+}
+
+#endif
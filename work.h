@@ -0,0 +1,101 @@
+#ifndef CHIPPY_WORK_H
+#define CHIPPY_WORK_H
+
+// Distributes batch runs over workers (chippy --worker) from a
+// coordinator (chippy-coord). Workers connect to the coordinator, which
+// hands out jobs: a ROM by hash, the Cxkk seed, replayed key changes and
+// a frame budget. A worker asks for ROMs it hasn't cached yet and sends a
+// result for every job. POSIX only.
+//
+// Messages are u32 payload length, u8 type, payload (little endian):
+//   worker: 'H' u16 threads                    hello
+//           'N' u64 hash                       needs that ROM
+//           'D' result, see work_encode_result
+//   coord:  'J' job, see work_encode_job
+//           'R' u64 hash, ROM bytes
+//           'Q'                                no more jobs, disconnect
+//
+// Addresses are "unix:PATH", "tcp:PORT" (the coordinator listens on all
+// interfaces, workers connect to 127.0.0.1) or "tcp:HOST:PORT"
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+
+#define WORK_MAX_ROM (CPU_MEM_SIZE - CPU_ROM_ADDR)
+#define WORK_MAX_EVENTS 1024
+#define WORK_MAX_MSG (32 + WORK_MAX_EVENTS * 6)
+#define WORK_DISP_SIZE DISPLAY_FRAME_SIZE
+#define WORK_HEADER 5 // u32 payload length, u8 type
+
+enum work_msg
+{
+    WORK_HELLO = 'H',
+    WORK_NEED_ROM = 'N',
+    WORK_RESULT = 'D',
+    WORK_JOB = 'J',
+    WORK_ROM = 'R',
+    WORK_QUIT = 'Q'
+};
+
+// The keys held from frame on
+struct work_event
+{
+    uint32_t frame;
+    uint16_t keys;
+};
+
+struct work_job
+{
+    uint32_t id;
+    uint64_t rom_hash; // quirks_rom_hash of the ROM
+    uint32_t seed;
+    uint32_t frames; // budget
+    uint16_t cycles; // per frame
+    uint8_t quirks;
+    uint8_t halt_check; // enum cpu_halt_check
+    uint16_t event_count;
+    struct work_event events[WORK_MAX_EVENTS];
+};
+
+struct work_result
+{
+    uint32_t id;
+    uint8_t status; // enum cpu_status
+    uint16_t pc;
+    uint32_t frames; // run, less than the budget if the cpu stopped
+    uint64_t cycles; // instructions executed
+    uint64_t disp_hash;
+    uint8_t disp[WORK_DISP_SIZE];
+};
+
+// Return the payload length
+size_t work_encode_job(const struct work_job *job, uint8_t *out);
+size_t work_encode_result(const struct work_result *res, uint8_t *out);
+
+// Return 0 if the payload is well formed
+int work_decode_job(const uint8_t *in, size_t len, struct work_job *job);
+int work_decode_result(const uint8_t *in, size_t len, struct work_result *res);
+
+// Return the socket or -1
+int work_listen(const char *addr);
+int work_accept(int listen_fd);
+int work_connect(const char *addr);
+
+// Framing for peers which buffer messages themselves (the coordinator's
+// sockets don't block). work_get_header returns the payload length.
+void work_put_header(uint8_t *out, uint8_t type, size_t len);
+uint32_t work_get_header(const uint8_t *in, uint8_t *type);
+
+// Blocking, return 0 on success
+int work_send(int fd, uint8_t type, const uint8_t *payload, size_t len);
+
+// Blocking, returns the payload length or -1 if the connection closed or
+// the message is larger than max
+int work_recv(int fd, uint8_t *type, uint8_t *payload, size_t max);
+
+// Worker mode of chippy, runs jobs on threads until the coordinator
+// quits, returns 0 on success
+int work_serve(const char *addr, int threads);
+
+#endif
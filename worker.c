@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include "work.h"
+#include "quirks.h"
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <unistd.h>
+
+// The coordinator keeps at most 2 jobs per thread on a worker, so the
+// queue and the jobs waiting for their ROM never overflow
+#define WORKER_MAX_THREADS 64
+#define WORKER_MAX_JOBS (2 * WORKER_MAX_THREADS)
+#define WORKER_ROM_CACHE 64
+
+struct worker_task
+{
+    struct work_job job;
+    uint16_t rom_len;
+    uint8_t rom[WORK_MAX_ROM];
+};
+
+struct worker_rom
+{
+    uint64_t hash;
+    uint16_t len; // 0 if the slot is unused
+    uint8_t data[WORK_MAX_ROM];
+};
+
+static int fd = -1;
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// job queue, filled by the connection thread
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct worker_task queue[WORKER_MAX_JOBS];
+static uint32_t queue_head;
+static uint32_t queue_count;
+static int quit;
+
+// ROMs by hash, replaced round robin
+static struct worker_rom roms[WORKER_ROM_CACHE];
+static uint32_t rom_next;
+
+// jobs whose ROM was asked for
+static struct work_job waiting[WORKER_MAX_JOBS];
+static uint32_t waiting_count;
+
+static struct chip8 cpus[WORKER_MAX_THREADS];
+static pthread_t threads[WORKER_MAX_THREADS];
+
+static void run_job(struct chip8 *cpu, const struct worker_task *task, struct work_result *res)
+{
+    const struct work_job *job = &task->job;
+    uint16_t event = 0;
+    uint32_t frame;
+
+    cpu_init(cpu);
+    memcpy(cpu->mem + CPU_ROM_ADDR, task->rom, task->rom_len);
+    cpu_set_quirks(cpu, (enum quirks)job->quirks);
+    cpu_seed(cpu, job->seed);
+    cpu_set_tick_cycles(cpu, job->cycles);
+
+    memset(res, 0, sizeof(*res));
+    // same order as the headless export, so results can be reproduced
+    // with chippy --export --replay-input --seed
+    for(frame=0; frame<job->frames && cpu->status == CPU_OK; frame++)
+    {
+        // the state hash check waits for the last key change
+        cpu->halt_check = event < job->event_count
+            ? job->halt_check & ~CPU_HALT_HASH : job->halt_check;
+        res->cycles += cpu_run(cpu, job->cycles);
+
+        uint16_t keys = cpu->keys;
+        while(event < job->event_count && job->events[event].frame <= frame)
+            keys = job->events[event++].keys;
+        cpu_set_keys(cpu, keys);
+    }
+
+    res->id = job->id;
+    res->status = cpu->status;
+    res->pc = cpu->pc;
+    res->frames = frame;
+    display_pack(&cpu->disp, res->disp);
+    res->disp_hash = quirks_rom_hash(res->disp, WORK_DISP_SIZE);
+}
+
+static void *thread_main(void *arg)
+{
+    struct chip8 *cpu = arg;
+    struct worker_task task;
+    uint8_t msg[WORK_MAX_MSG];
+    struct work_result res;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while(queue_count == 0 && !quit)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if(queue_count == 0)
+        {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+        task = queue[queue_head];
+        queue_head = (queue_head + 1) % WORKER_MAX_JOBS;
+        queue_count--;
+        pthread_mutex_unlock(&queue_lock);
+
+        run_job(cpu, &task, &res);
+        size_t len = work_encode_result(&res, msg);
+        pthread_mutex_lock(&send_lock);
+        work_send(fd, WORK_RESULT, msg, len);
+        pthread_mutex_unlock(&send_lock);
+    }
+}
+
+static struct worker_rom *find_rom(uint64_t hash)
+{
+    for(int r=0; r<WORKER_ROM_CACHE; r++)
+        if(roms[r].len > 0 && roms[r].hash == hash)
+            return &roms[r];
+    return NULL;
+}
+
+// Returns 1 if the queue is full
+static int enqueue(const struct work_job *job, const struct worker_rom *rom)
+{
+    pthread_mutex_lock(&queue_lock);
+    if(queue_count == WORKER_MAX_JOBS)
+    {
+        pthread_mutex_unlock(&queue_lock);
+        return 1;
+    }
+    struct worker_task *task = &queue[(queue_head + queue_count) % WORKER_MAX_JOBS];
+    task->job = *job;
+    task->rom_len = rom->len;
+    memcpy(task->rom, rom->data, rom->len);
+    queue_count++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+
+static int send_locked(uint8_t type, const uint8_t *payload, size_t len)
+{
+    pthread_mutex_lock(&send_lock);
+    int result = work_send(fd, type, payload, len);
+    pthread_mutex_unlock(&send_lock);
+    return result;
+}
+
+static int handle_job(const uint8_t *msg, int len)
+{
+    static struct work_job job;
+    if(work_decode_job(msg, (size_t)len, &job) != 0)
+        return 1;
+
+    struct worker_rom *rom = find_rom(job.rom_hash);
+    if(rom != NULL)
+        return enqueue(&job, rom);
+
+    if(waiting_count == WORKER_MAX_JOBS)
+        return 1;
+    // one request per ROM
+    int asked = 0;
+    for(uint32_t w=0; w<waiting_count; w++)
+        asked |= waiting[w].rom_hash == job.rom_hash;
+    waiting[waiting_count++] = job;
+    if(asked)
+        return 0;
+    uint8_t hash[8];
+    for(int k=0; k<8; k++)
+        hash[k] = (uint8_t)(job.rom_hash >> (8 * k));
+    return send_locked(WORK_NEED_ROM, hash, sizeof(hash));
+}
+
+static int handle_rom(const uint8_t *msg, int len)
+{
+    if(len < 8 || len - 8 > WORK_MAX_ROM)
+        return 1;
+    uint64_t hash = 0;
+    for(int k=7; k>=0; k--)
+        hash = hash << 8 | msg[k];
+    if(quirks_rom_hash(msg + 8, (size_t)len - 8) != hash)
+        return 1;
+
+    struct worker_rom *rom = &roms[rom_next];
+    rom_next = (rom_next + 1) % WORKER_ROM_CACHE;
+    rom->hash = hash;
+    rom->len = (uint16_t)(len - 8);
+    memcpy(rom->data, msg + 8, rom->len);
+
+    for(uint32_t w=0; w<waiting_count; )
+    {
+        if(waiting[w].rom_hash != hash)
+        {
+            w++;
+            continue;
+        }
+        if(enqueue(&waiting[w], rom) != 0)
+            return 1;
+        waiting[w] = waiting[--waiting_count];
+    }
+    return 0;
+}
+
+int work_serve(const char *addr, int thread_count)
+{
+    static uint8_t msg[WORK_MAX_MSG];
+    uint8_t type;
+    int len;
+    int result = 0;
+    uint64_t jobs = 0;
+
+    if(thread_count < 1)
+        thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(thread_count < 1)
+        thread_count = 1;
+    if(thread_count > WORKER_MAX_THREADS)
+        thread_count = WORKER_MAX_THREADS;
+
+    fd = work_connect(addr);
+    if(fd < 0)
+    {
+        printf("Failed to connect to %s\n", addr);
+        return 1;
+    }
+    uint8_t hello[2] = { (uint8_t)thread_count, (uint8_t)(thread_count >> 8) };
+    if(work_send(fd, WORK_HELLO, hello, sizeof(hello)) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    printf("Worker connected to %s with %d threads\n", addr, thread_count);
+
+    for(int t=0; t<thread_count; t++)
+        pthread_create(&threads[t], NULL, thread_main, &cpus[t]);
+
+    while((len = work_recv(fd, &type, msg, sizeof(msg))) >= 0 && type != WORK_QUIT)
+    {
+        if(type == WORK_JOB)
+        {
+            jobs++;
+            result = handle_job(msg, len);
+        }
+        else if(type == WORK_ROM)
+            result = handle_rom(msg, len);
+        else
+            result = 1;
+        if(result != 0)
+        {
+            printf("Bad message from the coordinator\n");
+            break;
+        }
+    }
+    if(len < 0)
+    {
+        printf("Lost the coordinator\n");
+        result = 1;
+    }
+
+    // a finished coordinator has all results, the queue is empty then
+    pthread_mutex_lock(&queue_lock);
+    quit = 1;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    for(int t=0; t<thread_count; t++)
+        pthread_join(threads[t], NULL);
+    close(fd);
+    printf("Worker ran %llu jobs\n", (unsigned long long)jobs);
+    return result;
+}
+
+#else
+
+int work_serve(const char *addr, int thread_count)
+{
+    (void)addr;
+    (void)thread_count;
+    printf("Workers aren't supported on Windows\n");
+    return 1;
+}
+
+#endif